@@ -0,0 +1,133 @@
+//
+// chunkcodec.h
+//
+
+#ifndef _CHUNKCODEC_H_
+#define _CHUNKCODEC_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <zlib.h>
+#include "dbstream.h"
+#include "crc32c.h"
+
+//
+// Data chunks of the streams written with a codec or checksum are framed as:
+//
+//   [u8 codec][u32 decoded size][u32 CRC32C of decoded chunk][encoded data]
+//
+// The numbers are little endian, and the CRC32C is there only if the codec
+// byte has the CHUNK_FRAME_CRC32C flag. The chunk that doesn't get smaller
+// is stored as is (DB_STREAM_CODEC_NONE), so the frame is never more than
+// CHUNK_FRAME_HEADER_SIZE bytes larger than the chunk itself.
+//
+#define CHUNK_FRAME_HEADER_SIZE 9
+#define CHUNK_FRAME_CRC32C      0x80
+
+#define STREAM_FORMAT_RAW     0   // Data chunks are stored as is
+#define STREAM_FORMAT_FRAMED  1   // Data chunks are framed (see above)
+#define STREAM_FORMAT_DEDUP   2   // Data chunks are framed and shared between streams (see chunkdedup.h)
+
+struct ChunkCodec
+{
+    // Encode the chunk into the frame buffer of at least
+    // CHUNK_FRAME_HEADER_SIZE + size bytes, and return the frame size
+    static size_t Encode(int codec, bool checksum, const unsigned char* data, size_t size, unsigned char* frame)
+    {
+        const size_t header_size = checksum ? CHUNK_FRAME_HEADER_SIZE : CHUNK_FRAME_HEADER_SIZE - 4;
+        size_t encoded_size = 0;
+
+        if(codec == DB_STREAM_CODEC_ZLIB && size > 1)
+        {
+            // Z_BUF_ERROR when the compressed chunk isn't smaller
+            uLongf dest_size = size - 1;
+            if(compress2(frame + header_size, &dest_size, data, size, Z_BEST_SPEED) == Z_OK)
+                encoded_size = dest_size;
+        }
+
+        if(encoded_size == 0)
+        {
+            codec = DB_STREAM_CODEC_NONE;
+            encoded_size = size;
+            memcpy(frame + header_size, data, size);
+        }
+
+        frame[0] = (unsigned char)(checksum ? codec | CHUNK_FRAME_CRC32C : codec);
+        PutUInt32(frame + 1, (uint32_t)size);
+        if(checksum)
+            PutUInt32(frame + 5, Crc32c::Compute(data, size));
+
+        return header_size + encoded_size;
+    }
+
+    // Decode the frame of the chunk up to max_size bytes (the chunk size of
+    // its stream). The data points either into the frame itself, or into the
+    // buffer for the compressed chunk. Returns false if the frame is corrupt,
+    // decodes to more than max_size, fails the checksum or is of unknown codec.
+    static bool Decode(const unsigned char* frame, size_t frame_size, size_t max_size,
+                       std::vector<unsigned char>& buf, const unsigned char** data, size_t* size)
+    {
+        if(frame_size < CHUNK_FRAME_HEADER_SIZE - 4)
+            return false;
+
+        const bool checksum = (frame[0] & CHUNK_FRAME_CRC32C) != 0;
+        const size_t header_size = checksum ? CHUNK_FRAME_HEADER_SIZE : CHUNK_FRAME_HEADER_SIZE - 4;
+        if(frame_size < header_size)
+            return false;
+
+        size_t decoded_size = GetUInt32(frame + 1);
+        if(decoded_size > max_size)
+            return false;
+
+        const unsigned char* encoded = frame + header_size;
+        size_t encoded_size = frame_size - header_size;
+
+        switch(frame[0] & ~CHUNK_FRAME_CRC32C)
+        {
+        case DB_STREAM_CODEC_NONE:
+            if(encoded_size != decoded_size)
+                return false;
+
+            *data = encoded;
+            *size = encoded_size;
+            break;
+
+        case DB_STREAM_CODEC_ZLIB:
+        {
+            if(buf.size() < decoded_size)
+                buf.resize(decoded_size);
+
+            uLongf dest_size = decoded_size;
+            if(uncompress(buf.data(), &dest_size, encoded, encoded_size) != Z_OK || dest_size != decoded_size)
+                return false;
+
+            *data = buf.data();
+            *size = decoded_size;
+            break;
+        }
+
+        default:
+            return false;
+        }
+
+        return !checksum || Crc32c::Compute(*data, *size) == GetUInt32(frame + 5);
+    }
+
+private:
+    static void PutUInt32(unsigned char* p, uint32_t value)
+    {
+        p[0] = (unsigned char)(value);
+        p[1] = (unsigned char)(value >> 8);
+        p[2] = (unsigned char)(value >> 16);
+        p[3] = (unsigned char)(value >> 24);
+    }
+
+    static uint32_t GetUInt32(const unsigned char* p)
+    {
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+};
+
+#endif // _CHUNKCODEC_H_
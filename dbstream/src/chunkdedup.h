@@ -0,0 +1,95 @@
+//
+// chunkdedup.h
+//
+
+#ifndef _CHUNKDEDUP_H_
+#define _CHUNKDEDUP_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include "sha256.h"
+
+//
+// Content-defined chunking for the deduplicated streams. The chunk boundaries
+// are found by the gear rolling hash of the data, so the same data is cut into
+// the same chunks wherever it is in the stream, and every chunk is stored once
+// by its SHA-256 (see MySqlStream::InsertSharedChunks()).
+//
+struct ChunkDedup
+{
+    // Return the size of the next chunk of the data, at most max_size bytes.
+    // The chunks are max_size/4 bytes at least, and about max_size/2 on
+    // average. The data shorter than max_size without a boundary is returned
+    // whole.
+    static size_t Cut(const unsigned char* data, size_t size, size_t max_size)
+    {
+        const uint64_t* gear = Gear();
+
+        size_t min_size = max_size / 4;
+        size_t end = (size < max_size ? size : max_size);
+        if(end <= min_size)
+            return end;
+
+        // The boundary is where the top bits of the hash are all 0, one position
+        // in 2^bits, about max_size/4 bytes past the min size on average
+        int bits = 0;
+        while(((size_t)2 << bits) <= max_size / 2)
+            bits++;
+        uint64_t mask = ~(uint64_t)0 << (64 - bits);
+
+        uint64_t hash = 0;
+        for(size_t i = min_size; i < end; i++)
+        {
+            hash = (hash << 1) + gear[data[i]];
+            if((hash & mask) == 0)
+                return i + 1;
+        }
+
+        return end;
+    }
+
+    // Return the SHA-256 of the data in hex. The chunks are shared by the
+    // hash alone, so it has to be collision resistant against the crafted
+    // data of another writer.
+    static std::string Hash(const unsigned char* data, size_t size)
+    {
+        unsigned char digest[Sha256::DIGEST_SIZE];
+        Sha256::Compute(data, size, digest);
+
+        char hex[Sha256::DIGEST_SIZE * 2 + 1] = {0};
+        for(size_t i = 0; i < Sha256::DIGEST_SIZE; i++)
+            sprintf(hex + i * 2, "%02X", digest[i]);
+
+        return hex;
+    }
+
+private:
+    // Random value per byte value. The table must never change, or the new
+    // chunks don't match the stored ones anymore.
+    static const uint64_t* Gear()
+    {
+        static struct Table
+        {
+            uint64_t values[256];
+
+            Table()
+            {
+                // splitmix64
+                uint64_t seed = 0x6765617268617368ULL;
+                for(int i = 0; i < 256; i++)
+                {
+                    uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+                    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+                    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+                    values[i] = z ^ (z >> 31);
+                }
+            }
+        } table;
+
+        return table.values;
+    }
+};
+
+#endif // _CHUNKDEDUP_H_
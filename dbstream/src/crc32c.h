@@ -0,0 +1,112 @@
+//
+// crc32c.h
+//
+
+#ifndef _CRC32C_H_
+#define _CRC32C_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRC32C_SSE42
+#include <nmmintrin.h>
+#endif
+
+//
+// CRC32C (Castagnoli) of the data chunks. Uses the SSE4.2 crc32 instruction
+// when the CPU has it, and the slicing-by-8 tables otherwise.
+//
+struct Crc32c
+{
+    static uint32_t Compute(const void* data, size_t size)
+    {
+#ifdef CRC32C_SSE42
+        static const bool hardware = __builtin_cpu_supports("sse4.2");
+        if(hardware)
+            return ComputeHardware((const unsigned char*)data, size);
+#endif
+        return ComputeSoftware((const unsigned char*)data, size);
+    }
+
+private:
+#ifdef CRC32C_SSE42
+    __attribute__((target("sse4.2")))
+    static uint32_t ComputeHardware(const unsigned char* p, size_t size)
+    {
+#ifdef __x86_64__
+        uint64_t crc = 0xFFFFFFFF;
+        for(; size >= 8; p += 8, size -= 8)
+        {
+            uint64_t v;
+            memcpy(&v, p, 8);
+            crc = _mm_crc32_u64(crc, v);
+        }
+        uint32_t crc32 = (uint32_t)crc;
+#else
+        uint32_t crc32 = 0xFFFFFFFF;
+        for(; size >= 4; p += 4, size -= 4)
+        {
+            uint32_t v;
+            memcpy(&v, p, 4);
+            crc32 = _mm_crc32_u32(crc32, v);
+        }
+#endif
+        for(; size > 0; p++, size--)
+            crc32 = _mm_crc32_u8(crc32, *p);
+
+        return ~crc32;
+    }
+#endif
+
+    static uint32_t ComputeSoftware(const unsigned char* p, size_t size)
+    {
+        const uint32_t (*table)[256] = Table();
+        uint32_t crc = 0xFFFFFFFF;
+
+        for(; size >= 8; p += 8, size -= 8)
+        {
+            uint32_t lo = crc ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+            uint32_t hi = (uint32_t)p[4] | ((uint32_t)p[5] << 8) | ((uint32_t)p[6] << 16) | ((uint32_t)p[7] << 24);
+
+            crc = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^ table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24] ^
+                  table[3][hi & 0xFF] ^ table[2][(hi >> 8) & 0xFF] ^ table[1][(hi >> 16) & 0xFF] ^ table[0][hi >> 24];
+        }
+
+        for(; size > 0; p++, size--)
+            crc = table[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+
+        return ~crc;
+    }
+
+    // Slicing-by-8 tables of the reflected polynomial 0x82F63B78
+    static const uint32_t (*Table())[256]
+    {
+        static struct Tables
+        {
+            uint32_t values[8][256];
+
+            Tables()
+            {
+                for(uint32_t i = 0; i < 256; i++)
+                {
+                    uint32_t crc = i;
+                    for(int bit = 0; bit < 8; bit++)
+                        crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+                    values[0][i] = crc;
+                }
+
+                for(int k = 1; k < 8; k++)
+                {
+                    for(uint32_t i = 0; i < 256; i++)
+                        values[k][i] = values[0][values[k - 1][i] & 0xFF] ^ (values[k - 1][i] >> 8);
+                }
+            }
+        } tables;
+
+        return tables.values;
+    }
+};
+
+#endif // _CRC32C_H_
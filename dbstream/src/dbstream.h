@@ -8,11 +8,22 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <istream>
+#include <future>
 
 #define DB_STREAM_READ_BEGIN  1   // Stream reading begin
 #define DB_STREAM_READ_DATA   2   // Stream reading in progress
 #define DB_STREAM_READ_END    3   // Stream reading completed
 
+#define DB_STREAM_READ_MODE_CHUNK   1   // Query stream data one chunk at a time (default)
+#define DB_STREAM_READ_MODE_STREAM  2   // Query all stream data chunks at once
+#define DB_STREAM_READ_MODE_BATCH   3   // Query all streams and chunks of a read batch at once
+
+#define DB_STREAM_LOCK_TABLES       1   // Lock the tables while reading and deleting (default)
+#define DB_STREAM_LOCK_SNAPSHOT     2   // Read consistent snapshot and rely on row locks
+
+#define DB_STREAM_CODEC_NONE        0   // Store stream data as is (default)
+#define DB_STREAM_CODEC_ZLIB        1   // Compress stream data chunks with zlib at its fastest level
+
 //
 // Stream header
 //
@@ -25,6 +36,56 @@ struct StreamHeader
     uint64_t size;
 };
 
+//
+// Stream options
+//
+struct DBStreamOptions
+{
+    int read_mode = DB_STREAM_READ_MODE_CHUNK;  // How stream data is queried by ReadById()
+    bool read_unbuffered = false;               // Deliver stream data while it is still arriving
+                                                // (DB_STREAM_READ_MODE_STREAM/BATCH only)
+    bool read_direct = false;                   // Pass OnRead() every data chunk in one piece, copied
+                                                // once out of the fetched row instead of three times
+                                                // through the read buffer, the data is only valid
+                                                // until OnRead() returns
+    int lock_mode = DB_STREAM_LOCK_TABLES;      // How reading is isolated from deleting
+    size_t chunk_size = 65535;                  // Max bytes of stream data per data row, the new
+                                                // data table column is BLOB/MEDIUMBLOB/LONGBLOB
+                                                // for chunks up to 64KB/16MB/4GB
+    size_t write_batch_size = 4*1024*1024;      // Max bytes of data chunks per INSERT statement
+                                                // (limited by the server max_allowed_packet)
+    size_t group_commit_size = 100;             // Max streams written per transaction by WriteBatch()
+                                                // and by DBStreamWriter
+    size_t group_commit_latency = 0;            // Max milliseconds DBStreamWriter waits for more
+                                                // streams to fill the transaction
+    size_t follow_min_wait = 10;                // Min and max milliseconds Follow() waits before
+    size_t follow_max_wait = 100;               // checking for new streams again, the wait
+                                                // doubles while there are no new streams
+    size_t follow_gap_wait = 1000;              // Max milliseconds Follow() waits for the stream of
+                                                // a missing id to be committed before it reads the
+                                                // later ones (group_commit_latency at least)
+    size_t parallel_slice_size = 1000;          // Ids per slice the DBStreamPool::ReadById() range
+                                                // is split into between the pool streams (streams
+                                                // per slice on average for ReadByTimestamp())
+    size_t parallel_buffer_size = 64*1024*1024; // Max bytes of the later slices buffered by the
+                                                // ordered DBStreamPool reading
+    size_t partition_size = 0;                  // Stream ids per partition of the new tables, so
+                                                // DropExpired() drops old streams a partition at
+                                                // a time (0 for no partitioning)
+    size_t purge_batch_size = 1000;             // Max streams deleted per transaction by Purge*()
+    size_t purge_rate = 0;                      // Max streams deleted per second by Purge*()
+                                                // (0 for no limit)
+    int codec = DB_STREAM_CODEC_NONE;           // How the written data chunks are compressed, the
+                                                // chunks that don't compress are stored as is and
+                                                // reading decompresses transparently
+    bool dedup = false;                         // Cut the written streams into chunks by their
+                                                // content (chunk_size/2 bytes on average) and
+                                                // store every distinct chunk once, shared by
+                                                // reference between the streams
+    bool checksum = false;                      // Store a CRC32C of every written data chunk and
+                                                // verify it on read, reading a corrupt chunk fails
+};
+
 //
 // Interface to DB stream reader
 //
@@ -36,6 +97,37 @@ struct DBStreamReader
                         int reading_state) = 0;
 };
 
+//
+// Interface to DB stream cursor to pull the streams one by one instead of
+// getting them pushed to DBStreamReader. The cursor uses the connection of
+// its DB stream, so Close() it before the stream is destroyed or released.
+//
+struct DBStreamCursor
+{
+    virtual ~DBStreamCursor() = default;
+
+    // Move to the next stream, found is false when there are no more streams
+    virtual bool Next(StreamHeader* hdr, bool* found) = 0;
+
+    // Read up to buf_size bytes of the current stream data,
+    // size is 0 when all data of the stream has been read
+    virtual bool ReadChunk(unsigned char* buf, size_t buf_size, size_t* size) = 0;
+
+    virtual void Close() = 0;
+};
+
+//
+// Interface to DB stream purge progress
+//
+struct DBStreamPurgeProgress
+{
+    virtual ~DBStreamPurgeProgress() = default;
+
+    // Called after every deleted batch with the number of streams deleted
+    // so far and the id of the last one. Return false to stop purging.
+    virtual bool OnPurge(uint64_t deleted, uint64_t id_last) = 0;
+};
+
 //
 // Interface to DB stream logger
 //
@@ -75,6 +167,126 @@ struct DBStream
 
     // Diagnostics
     virtual bool Describe() = 0;
+
+    //
+    // The methods added since are declared below, so the vtable of the
+    // callers built against the interface above stays the same. Add the
+    // new methods at the end only.
+    //
+
+    // Write count streams with a commit per group_commit_size streams
+    virtual bool WriteBatch(const StreamHeader* hdrs, const unsigned char* const* data, size_t count) = 0;
+
+    // Keep reading the streams after id_first as they are written, until
+    // the reader stops it or StopFollow() is called (from any thread). The
+    // streams are read in id order, the stream committed after a larger id
+    // is waited for up to follow_gap_wait.
+    virtual bool Follow(uint64_t id_first, bool inclusive_first) = 0;
+    virtual void StopFollow() = 0;
+
+    // Open cursor over the same streams ReadById() would read, or NULL on failure
+    virtual DBStreamCursor* OpenCursorById(uint64_t id_first, bool inclusive_first,
+                                           uint64_t id_last,  bool inclusive_last) = 0;
+
+    virtual bool ReadByTimestamp(uint64_t timestamp_first, bool inclusive_first,
+                                 uint64_t timestamp_last,  bool inclusive_last) = 0;
+    virtual bool DeleteByTimestamp(uint64_t timestamp_first, bool inclusive_first,
+                                   uint64_t timestamp_last,  bool inclusive_last) = 0;
+    virtual bool LookupByTimestamp(uint64_t timestamp, bool* found) = 0;
+
+    // Drop the partitions of streams all older than timestamp_before,
+    // and add new partitions ahead of the writes (partitioned tables only)
+    virtual bool DropExpired(uint64_t timestamp_before) = 0;
+
+    virtual bool DeleteAll(bool reset_id) = 0; // Start the ids from 1 again if reset_id
+
+    // Delete the streams in batches of purge_batch_size streams, each batch
+    // in its own transaction, at most purge_rate streams per second. Meant
+    // to run on its own thread and stream, so it doesn't stall the writers.
+    virtual bool PurgeById(uint64_t id_first, bool inclusive_first,
+                           uint64_t id_last,  bool inclusive_last,
+                           DBStreamPurgeProgress* progress) = 0;
+    virtual bool PurgeByTimestamp(uint64_t timestamp_first, bool inclusive_first,
+                                  uint64_t timestamp_last,  bool inclusive_last,
+                                  DBStreamPurgeProgress* progress) = 0;
+
+    // Convert the data table created before the data chunks were keyed by
+    // (stream id, chunk number) to the new layout, so the chunks of every
+    // stream are stored together. Rebuilds the table with the tables locked,
+    // and the other DB streams have to be recreated after it.
+    virtual bool MigrateLayout() = 0;
+
+    // Read size bytes of the stream data from offset on (up to the end of the
+    // stream if size is 0). Only the data chunks of the range are fetched, and
+    // the reader gets just the bytes of the range, every chunk in one piece.
+    virtual bool ReadRange(uint64_t id, uint64_t offset, uint64_t size, bool* found) = 0;
+
+    // Write the stream over time: Open() it (the header size is ignored),
+    // Append() the data as it comes, each append committed on its own, and
+    // Seal() it when complete. ReadById() and the like, the cursors and the
+    // pool skip the open streams, and Follow() waits at the first open one
+    // until it is sealed. ReadRange() and Tail() read them as far as appended.
+    // Append() and Seal() fail for the stream that is not open (any longer).
+    virtual bool Open(const StreamHeader* hdr) = 0;
+    virtual bool Append(const StreamHeader* hdr, const unsigned char* data, size_t size) = 0;
+    virtual bool Seal(const StreamHeader* hdr) = 0;
+
+    // Keep reading the stream data from offset on as it is appended, until
+    // the stream is sealed, the reader stops it or StopFollow() is called
+    virtual bool Tail(uint64_t id, uint64_t offset, bool* found) = 0;
+};
+
+//
+// Interface to pool of DB streams to be used from multiple threads.
+// Every stream is used by one thread at a time: Acquire() it, use it
+// and Release() it back to the pool. Don't Destroy() acquired stream.
+//
+struct DBStreamPool
+{
+    virtual ~DBStreamPool() = default;
+    virtual bool IsValid() = 0;
+    virtual void Destroy() = 0;
+
+    // Wait until a stream is available. The reader replaces
+    // the pool reader until the stream is released (if not NULL).
+    virtual DBStream* Acquire(DBStreamReader* reader) = 0;
+    virtual void Release(DBStream* stream) = 0;
+
+    // Read the id range with all pool streams in parallel, slice by slice.
+    // Ordered reading delivers the streams to the pool reader in id order
+    // from one thread at a time. The slice next in line is passed through
+    // as it is read, and the later slices are buffered up to
+    // parallel_buffer_size bytes, their threads wait when it is full.
+    // Unordered reading calls the pool reader from all the threads at once.
+    virtual bool ReadById(uint64_t id_first, bool inclusive_first,
+                          uint64_t id_last,  bool inclusive_last,
+                          bool ordered) = 0;
+
+    // Read the timestamp range the same way, split into the slices of equal
+    // timestamp span, parallel_slice_size streams per slice on average.
+    // Ordered reading delivers the streams in timestamp and id order.
+    virtual bool ReadByTimestamp(uint64_t timestamp_first, bool inclusive_first,
+                                 uint64_t timestamp_last,  bool inclusive_last,
+                                 bool ordered) = 0;
+};
+
+//
+// Interface to asynchronous DB stream writer. Write() copies the stream
+// into the bounded queue and returns right away, the queued streams are
+// written by the background thread.
+//
+struct DBStreamWriter
+{
+    virtual ~DBStreamWriter() = default;
+    virtual bool IsValid() = 0;
+    virtual void Destroy() = 0; // Writes all queued streams first
+
+    // The future gets the id of the written stream, or 0 if the writing
+    // failed or the queue was full
+    virtual std::future<uint64_t> Write(const StreamHeader* hdr, const unsigned char* data) = 0;
+
+    // Wait until all queued streams are written
+    virtual void Flush() = 0;
 };
 
 extern "C"
@@ -87,9 +299,41 @@ extern "C"
     typedef DBStream* (*CreateDBStreamPtr)(const char*, const char*, const char*,
                                                const char*, DBStreamReader*,
                                                DBStreamLogger*);
+
+    __attribute__((visibility("default")))
+    DBStream* CreateDBStreamEx(const char* host, const char* user, const char* passwd,
+                               const char* database, DBStreamReader* reader,
+                               DBStreamLogger* logger, const DBStreamOptions* options);
+
+    typedef DBStream* (*CreateDBStreamExPtr)(const char*, const char*, const char*,
+                                                 const char*, DBStreamReader*,
+                                                 DBStreamLogger*, const DBStreamOptions*);
+
+    __attribute__((visibility("default")))
+    DBStreamPool* CreateDBStreamPool(const char* host, const char* user, const char* passwd,
+                                     const char* database, DBStreamReader* reader,
+                                     DBStreamLogger* logger, const DBStreamOptions* options,
+                                     size_t size);
+
+    typedef DBStreamPool* (*CreateDBStreamPoolPtr)(const char*, const char*, const char*,
+                                                       const char*, DBStreamReader*,
+                                                       DBStreamLogger*, const DBStreamOptions*,
+                                                       size_t);
+
+    __attribute__((visibility("default")))
+    DBStreamWriter* CreateDBStreamWriter(const char* host, const char* user, const char* passwd,
+                                         const char* database, DBStreamLogger* logger,
+                                         const DBStreamOptions* options, size_t queue_size);
+
+    typedef DBStreamWriter* (*CreateDBStreamWriterPtr)(const char*, const char*, const char*,
+                                                           const char*, DBStreamLogger*,
+                                                           const DBStreamOptions*, size_t);
 }
 
-#define CREATE_DB_STREAM_FUNC_NAME "CreateDBStream"
+#define CREATE_DB_STREAM_FUNC_NAME        "CreateDBStream"
+#define CREATE_DB_STREAM_EX_FUNC_NAME     "CreateDBStreamEx"
+#define CREATE_DB_STREAM_POOL_FUNC_NAME   "CreateDBStreamPool"
+#define CREATE_DB_STREAM_WRITER_FUNC_NAME "CreateDBStreamWriter"
 
 #endif // _DBSTREAM_H_
 
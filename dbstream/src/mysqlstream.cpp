@@ -4,9 +4,18 @@
 #include <stdlib.h>
 #include <sstream>
 #include <string.h>
+#include <strings.h> // strcasecmp
+#include <algorithm> // std::min
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <stdio.h>  // sprintf
 #include "mysqlstream.h"
+#include "mysqlstreamcursor.h"
 #include "streambuf.h"
+#include "chunkcodec.h"
+#include "chunkdedup.h"
 
 #include <cppconn/exception.h>
 #include <cppconn/metadata.h>
@@ -16,19 +25,50 @@
 
 #define MODULE_NAME       "MySqlStream"
 
-#define DB_ENGINE         "InnoDB";      // Database engine type
+#define DB_ENGINE         "InnoDB"       // Database engine type
 #define STREAM_TABLE      "stream"       // Stream table
 #define STREAMDATA_TABLE  "streamdata"   // Stream data table
+#define STREAMCHUNK_TABLE "streamchunk"  // Shared chunks of the deduplicated streams
+#define CHUNKSTORE_TABLE  "chunkstore"   // Shared chunk data by hash
+
+#define STREAM_STATE_SEALED  0   // Stream is complete (default)
+#define STREAM_STATE_OPEN    1   // Stream is being appended to (see Open())
 
 const size_t STREAMS_PER_QUERY = 100; // Max number of streams per query
+const size_t PARTITIONS_AHEAD = 4;    // Number of empty partitions kept ahead of the writes
 //const size_t STREAMS_PER_QUERY = 5; // Max number of streams per query
 
 
+//
+// Process wide notification about committed streams, so Follow()
+// wakes up right away when a stream is written by this process
+//
+static std::mutex gCommitMutex;
+static std::condition_variable gCommitCond;
+static uint64_t gCommitCount = 0;
+
+static void NotifyCommit()
+{
+    {
+        std::lock_guard<std::mutex> lock(gCommitMutex);
+        gCommitCount++;
+    }
+
+    gCommitCond.notify_all();
+}
+
 DBStream* CreateDBStream(const char* host, const char* user, const char* passwd,
                              const char* database, DBStreamReader* reader,
                              DBStreamLogger* logger)
 {
-    MySqlStream* mysqlStream = MySqlStream::Create(host, user, passwd, database, reader, logger);
+    return CreateDBStreamEx(host, user, passwd, database, reader, logger, NULL);
+}
+
+DBStream* CreateDBStreamEx(const char* host, const char* user, const char* passwd,
+                               const char* database, DBStreamReader* reader,
+                               DBStreamLogger* logger, const DBStreamOptions* options)
+{
+    MySqlStream* mysqlStream = MySqlStream::Create(host, user, passwd, database, reader, logger, options);
     
     if(mysqlStream != NULL && !mysqlStream->IsValid())
     {
@@ -42,24 +82,113 @@ DBStream* CreateDBStream(const char* host, const char* user, const char* passwd,
 //
 // Helpers to READ/WRITE lock/unlock tables
 //
+// With DB_STREAM_LOCK_SNAPSHOT there are no table locks at all: the reading
+// runs in a transaction with InnoDB consistent snapshot, and the deletion
+// relies on InnoDB row locks, so neither blocks the other or Write()
+//
 struct SqlLock
 {
     enum LOCK_TYPE : char { LOCK_READ=1, LOCK_WRITE };
 
-    SqlLock(const std::unique_ptr<sql::Statement>& s, LOCK_TYPE type) : _s(s.get())  { Lock(type); }
-    SqlLock(sql::Statement* s, LOCK_TYPE type) : _s(s) { Lock(type); }
+    SqlLock(const std::unique_ptr<sql::Statement>& s, LOCK_TYPE type, int mode) : _s(s.get()), _type(type), _mode(mode) { Lock(); }
+    SqlLock(sql::Statement* s, LOCK_TYPE type, int mode) : _s(s), _type(type), _mode(mode) { Lock(); }
     ~SqlLock() { Unlock(); }
     SqlLock& operator=(const SqlLock&) = delete; // Don't allow class copy
 
-    inline void Lock(LOCK_TYPE type)
+    inline void Lock()
     {
-        if(type == LOCK_READ)
-            _s->execute("LOCK TABLES " STREAM_TABLE " READ LOCAL, " STREAMDATA_TABLE " READ LOCAL");
+        if(_mode == DB_STREAM_LOCK_SNAPSHOT)
+        {
+            if(_type == LOCK_READ)
+                _s->execute("START TRANSACTION WITH CONSISTENT SNAPSHOT");
+        }
+        else if(_type == LOCK_READ)
+            _s->execute("LOCK TABLES " STREAM_TABLE " READ LOCAL, " STREAMDATA_TABLE " READ LOCAL, "
+                        STREAMCHUNK_TABLE " READ LOCAL, " CHUNKSTORE_TABLE " READ LOCAL");
         else
-            _s->execute("LOCK TABLES " STREAM_TABLE " WRITE, " STREAMDATA_TABLE " WRITE");
+            _s->execute("LOCK TABLES " STREAM_TABLE " WRITE, " STREAMDATA_TABLE " WRITE, "
+                        STREAMCHUNK_TABLE " WRITE, " CHUNKSTORE_TABLE " WRITE");
+    }
+
+    inline void Unlock()
+    {
+        if(_mode != DB_STREAM_LOCK_SNAPSHOT)
+            _s->execute("UNLOCK TABLES");
+        else if(_type == LOCK_READ)
+            _s->execute("COMMIT");
+    }
+
+private:
+    sql::Statement* _s;
+    LOCK_TYPE _type;
+    int _mode;
+};
+
+//
+// Helper to get the beginning of DELETE statement of streams. The partitioned
+// tables have no foreign key to cascade the deletion, so the stream data and
+// the shared chunk references are deleted along with the streams.
+//
+static const char* SqlDeleteFrom(bool partitioned)
+{
+    return (partitioned ?
+        "DELETE " STREAM_TABLE ", " STREAMDATA_TABLE ", " STREAMCHUNK_TABLE " FROM " STREAM_TABLE
+        " LEFT JOIN " STREAMDATA_TABLE " ON " STREAMDATA_TABLE ".masterid = " STREAM_TABLE ".id"
+        " LEFT JOIN " STREAMCHUNK_TABLE " ON " STREAMCHUNK_TABLE ".masterid = " STREAM_TABLE ".id" :
+        "DELETE FROM " STREAM_TABLE);
+}
+
+//
+// Helper to run the statements in a transaction, rolled back unless committed.
+// Declare it after SqlLock, so it is rolled back before UNLOCK TABLES would
+// commit it.
+//
+struct SqlTransaction
+{
+    SqlTransaction(sql::Connection* con) : _con(con) { _con->setAutoCommit(false); }
+    ~SqlTransaction()
+    {
+        try
+        {
+            if(!_committed)
+                _con->rollback();
+            _con->setAutoCommit(true);
+        }
+        catch(...) {}
     }
+    SqlTransaction& operator=(const SqlTransaction&) = delete; // Don't allow class copy
+
+    void Commit() { _con->commit(); _committed = true; }
+
+private:
+    sql::Connection* _con;
+    bool _committed = false;
+};
 
-    inline void Unlock() { _s->execute("UNLOCK TABLES"); }
+//
+// Data column types by the max data chunk size they fit
+//
+static const struct { const char* type; size_t max_size; } BLOB_TYPES[] =
+{
+    { "BLOB",       65535 },        // 2^16-1
+    { "MEDIUMBLOB", 16777215 },     // 2^24-1
+    { "LONGBLOB",   4294967295UL }  // 2^32-1
+};
+const size_t BLOB_TYPES_COUNT = sizeof(BLOB_TYPES) / sizeof(BLOB_TYPES[0]);
+
+//
+// Helper to disable the foreign key checks for the session
+//
+struct SqlNoForeignKeyChecks
+{
+    SqlNoForeignKeyChecks(const std::unique_ptr<sql::Statement>& s) : _s(s.get()) { _s->execute("SET FOREIGN_KEY_CHECKS=0"); }
+    ~SqlNoForeignKeyChecks()
+    {
+        // Don't throw while unwinding, the session is gone with the lost connection anyway
+        try { _s->execute("SET FOREIGN_KEY_CHECKS=1"); }
+        catch(sql::SQLException&) {}
+    }
+    SqlNoForeignKeyChecks& operator=(const SqlNoForeignKeyChecks&) = delete; // Don't allow class copy
 
 private:
     sql::Statement* _s;
@@ -67,12 +196,12 @@ private:
 
 struct SqlLockRead : public SqlLock
 {
-    SqlLockRead(const std::unique_ptr<sql::Statement>& s) : SqlLock(s, LOCK_READ) {}
+    SqlLockRead(const std::unique_ptr<sql::Statement>& s, int mode) : SqlLock(s, LOCK_READ, mode) {}
 };
 
 struct SqlLockWrite : public SqlLock
 {
-    SqlLockWrite(const std::unique_ptr<sql::Statement>& s) : SqlLock(s, LOCK_WRITE) {}
+    SqlLockWrite(const std::unique_ptr<sql::Statement>& s, int mode) : SqlLock(s, LOCK_WRITE, mode) {}
 };
 
 
@@ -122,8 +251,14 @@ struct SqlLockWrite : public SqlLock
 //
 MySqlStream::MySqlStream(const char* host, const char* user, const char* passwd,
                                  const char* database, DBStreamReader* reader,
-                                 DBStreamLogger* logger) : mReader(reader), mLogger(logger)
+                                 DBStreamLogger* logger, const DBStreamOptions* options) : mReader(reader), mLogger(logger)
 {
+    if(options != NULL)
+        mOptions = *options;
+
+    if(mOptions.chunk_size == 0)
+        mOptions.chunk_size = DBStreamOptions().chunk_size;
+
     TRY
     {
         // Using the Driver to create a connection
@@ -137,7 +272,8 @@ MySqlStream::MySqlStream(const char* host, const char* user, const char* passwd,
             mCon.reset(); // Delete connection object
         }
 
-        memset(mBuf, 0, sizeof(mBuf));
+        // Read buffer grows up to the chunk size of the read stream
+        mBuf.resize(mOptions.chunk_size);
     }
     CATCH
 }
@@ -191,6 +327,10 @@ bool MySqlStream::InitDatabase(const char* database)
         
         // Set schema
         mCon->setSchema(database);
+
+        // Consistent snapshot is only there for REPEATABLE READ isolation level
+        if(mOptions.lock_mode == DB_STREAM_LOCK_SNAPSHOT)
+            mCon->setTransactionIsolation(sql::TRANSACTION_REPEATABLE_READ);
         //std::unique_ptr<sql::Statement> stmt(con->createStatement());
         //stmt->execute("USE " DB_NAME);
 
@@ -204,6 +344,15 @@ bool MySqlStream::InitDatabase(const char* database)
         if(!InitTranTable(*con_meta) || !InitTranDataTable(*con_meta))
             THROW("InitTable failed");
 
+        if(!InitPartitions())
+            THROW("InitPartitions failed");
+
+        if(!InitChunkTables(*con_meta))
+            THROW("InitChunkTables failed");
+
+        if(!InitWriteBatch())
+            THROW("InitWriteBatch failed");
+
         return true;
     }
     CATCH
@@ -239,6 +388,60 @@ bool MySqlStream::LookupTable(sql::DatabaseMetaData& con_meta, const char* table
     return false;
 }
 
+// Add the column to the existing table unless it is already there
+bool MySqlStream::InitColumn(const char* table, const char* column, const char* definition)
+{
+    TRY
+    {
+        std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
+        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery(
+            "SHOW COLUMNS FROM " + std::string(table) + " LIKE '" + column + "'"));
+
+        if(res->rowsCount() == 0)
+        {
+            WriteToLog(LOG_INFO, MODULE_NAME ": The table '" + std::string(table) + "' has no column '" + column + "'. Add...");
+
+            std::string sql = "ALTER TABLE " + std::string(table) + " ADD COLUMN " + column + " " + definition;
+            WriteToLog(LOG_INFO, sql);
+            stmt->execute(sql);
+
+            WriteToLog(LOG_INFO, MODULE_NAME ": The column '" + std::string(column) + "' added.");
+        }
+
+        return true;
+    }
+    CATCH
+
+    return false;
+}
+
+// Add the index to the existing table unless it is already there
+bool MySqlStream::InitIndex(const char* table, const char* index, const char* columns)
+{
+    TRY
+    {
+        std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
+        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery(
+            "SHOW INDEX FROM " + std::string(table) + " WHERE Key_name = '" + index + "'"));
+
+        if(res->rowsCount() == 0)
+        {
+            WriteToLog(LOG_INFO, MODULE_NAME ": The table '" + std::string(table) + "' has no index '" + index + "'. Add...");
+
+            std::string sql = "ALTER TABLE " + std::string(table) + " ADD INDEX " + index + "(" + columns + ")";
+            WriteToLog(LOG_INFO, sql);
+            stmt->execute(sql);
+
+            WriteToLog(LOG_INFO, MODULE_NAME ": The index '" + std::string(index) + "' added.");
+        }
+
+        return true;
+    }
+    CATCH
+
+    return false;
+}
+
 bool MySqlStream::InitTranTable(sql::DatabaseMetaData& con_meta)
 {
     TRY
@@ -251,6 +454,23 @@ bool MySqlStream::InitTranTable(sql::DatabaseMetaData& con_meta)
         if(hasTable)
         {
             WriteToLog(LOG_INFO, MODULE_NAME ": The table '" STREAM_TABLE "' exists.");
+
+            // Streams written before the chunk size became configurable
+            // all have been split into 65535 bytes chunks
+            if(!InitColumn(STREAM_TABLE, "chunksize", "INT UNSIGNED NOT NULL DEFAULT '65535'"))
+                THROW("InitColumn failed");
+
+            // Streams written before compression have raw data chunks
+            if(!InitColumn(STREAM_TABLE, "format", "TINYINT UNSIGNED NOT NULL DEFAULT '0'"))
+                THROW("InitColumn failed");
+
+            // Streams written before appending have been complete
+            if(!InitColumn(STREAM_TABLE, "state", "TINYINT UNSIGNED NOT NULL DEFAULT '0'"))
+                THROW("InitColumn failed");
+
+            // Reading and deleting by timestamp
+            if(!InitIndex(STREAM_TABLE, "timestamp_idx", "timestamp"))
+                THROW("InitIndex failed");
         }
         else
         {
@@ -263,7 +483,15 @@ bool MySqlStream::InitTranTable(sql::DatabaseMetaData& con_meta)
                                  "type TINYINT UNSIGNED NOT NULL DEFAULT '0', "
                                  "size BIGINT UNSIGNED NOT NULL DEFAULT '0', "
                                  "timestamp BIGINT UNSIGNED NOT NULL DEFAULT '0', "
-                                 "PRIMARY KEY(id)) ENGINE=" DB_ENGINE;
+                                 "chunksize INT UNSIGNED NOT NULL DEFAULT '65535', "
+                                 "format TINYINT UNSIGNED NOT NULL DEFAULT '0', "
+                                 "state TINYINT UNSIGNED NOT NULL DEFAULT '0', "
+                                 "PRIMARY KEY(id), "
+                                 "KEY timestamp_idx(timestamp)) ENGINE=" DB_ENGINE;
+
+            // Partitions are added by InitPartitions()
+            if(mOptions.partition_size > 0)
+                sql += " PARTITION BY RANGE(id) (PARTITION pmax VALUES LESS THAN MAXVALUE)";
 
             WriteToLog(LOG_INFO, sql);
 
@@ -289,24 +517,84 @@ bool MySqlStream::InitTranDataTable(sql::DatabaseMetaData& con_meta)
         if(!LookupTable(con_meta, STREAMDATA_TABLE, &hasTable))
             THROW("LookupTable failed");
 
+        // Framed chunks of the compressed or checksummed streams are a bit larger
+        const size_t frame_size = IsFramed() ? CHUNK_FRAME_HEADER_SIZE : 0;
+
         if(hasTable)
         {
             WriteToLog(LOG_INFO, MODULE_NAME ": The table '" STREAMDATA_TABLE "' exists.");
+
+            std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
+            std::unique_ptr<sql::ResultSet> res(stmt->executeQuery("SHOW COLUMNS FROM " STREAMDATA_TABLE " LIKE 'data'"));
+            if(!res->next())
+                THROW("The table '" STREAMDATA_TABLE "' has no data column");
+
+            std::string type = res->getString("Type");
+            size_t max_size = 255; // TINYBLOB
+
+            // The data column type limits the max chunk size
+            for(size_t i = 0; i < BLOB_TYPES_COUNT; i++)
+            {
+                if(strcasecmp(type.c_str(), BLOB_TYPES[i].type) == 0)
+                    max_size = BLOB_TYPES[i].max_size;
+            }
+
+            // Find out the layout of the data chunks. The table with both columns
+            // is half way through MigrateLayout() and is still keyed by the id.
+            res.reset(stmt->executeQuery("SHOW COLUMNS FROM " STREAMDATA_TABLE " WHERE Field IN ('id', 'seq')"));
+            mClustered = (res->rowsCount() == 1 && res->next() && res->getString("Field") == "seq");
+
+            if(!mClustered)
+                WriteToLog(LOG_INFO, MODULE_NAME ": The table '" STREAMDATA_TABLE "' has the data chunks keyed by id, see MigrateLayout()");
+
+            if(mOptions.chunk_size + frame_size > max_size)
+            {
+                std::stringstream msg;
+                msg << MODULE_NAME ": chunk size " << mOptions.chunk_size << " exceeds the '"
+                    << STREAMDATA_TABLE << "' data column type " << type << ", using " << max_size - frame_size;
+                WriteToLog(LOG_INFO, msg);
+
+                mOptions.chunk_size = max_size - frame_size;
+            }
         }
         else
         {
             WriteToLog(LOG_INFO, MODULE_NAME ": The table '" STREAMDATA_TABLE "' does not exist. Create...");
 
-            // Create table is not exist
+            // Use the smallest data column type to fit the chunk size
+            size_t i = 0;
+            while(i < BLOB_TYPES_COUNT - 1 && mOptions.chunk_size + frame_size > BLOB_TYPES[i].max_size)
+                i++;
+
+            if(mOptions.chunk_size + frame_size > BLOB_TYPES[i].max_size)
+                mOptions.chunk_size = BLOB_TYPES[i].max_size - frame_size;
+
+            // Create table is not exist. The data chunks are numbered from 1 within
+            // the stream, and clustered by the stream, so reading the stream is
+            // a single range scan of the primary key.
             sql::SQLString sql = "CREATE TABLE IF NOT EXISTS " STREAMDATA_TABLE " ("
-                                 "id BIGINT UNSIGNED NOT NULL AUTO_INCREMENT, "
                                  "masterid BIGINT UNSIGNED NOT NULL DEFAULT '0', "
-                                 "data BLOB NOT NULL, "
-                                 "PRIMARY KEY(id), "
+                                 "seq INT UNSIGNED NOT NULL DEFAULT '0', "
+                                 "data " + std::string(BLOB_TYPES[i].type) + " NOT NULL, "
+                                 "PRIMARY KEY(masterid, seq), "
                                  "FOREIGN KEY(masterid) "
                                  "REFERENCES " STREAM_TABLE "(id) "
                                  "ON DELETE CASCADE) ENGINE=" DB_ENGINE;
 
+            // The partitioned table is partitioned along with the stream table by the
+            // stream id. The partitioned tables can't have foreign keys.
+            if(mOptions.partition_size > 0)
+            {
+                sql = "CREATE TABLE IF NOT EXISTS " STREAMDATA_TABLE " ("
+                      "masterid BIGINT UNSIGNED NOT NULL DEFAULT '0', "
+                      "seq INT UNSIGNED NOT NULL DEFAULT '0', "
+                      "data " + std::string(BLOB_TYPES[i].type) + " NOT NULL, "
+                      "PRIMARY KEY(masterid, seq)) ENGINE=" DB_ENGINE;
+                sql += " PARTITION BY RANGE(masterid) (PARTITION pmax VALUES LESS THAN MAXVALUE)";
+            }
+
+            mClustered = true;
+
             WriteToLog(LOG_INFO, sql);
 
             std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
@@ -322,45 +610,102 @@ bool MySqlStream::InitTranDataTable(sql::DatabaseMetaData& con_meta)
     return false;
 }
 
-bool MySqlStream::Describe()
+// Create the tables of the deduplicated streams (see DBStreamOptions::dedup).
+// The shared chunks are always framed (see chunkcodec.h), with or without
+// codec. The chunk references of the partitioned streams have no foreign key,
+// and are deleted along with the streams.
+bool MySqlStream::InitChunkTables(sql::DatabaseMetaData& con_meta)
 {
     TRY
     {
-        // Describe the actual table (if exists)
-        const char* tables[] = { STREAM_TABLE, STREAMDATA_TABLE, NULL };
+        bool hasTable = false;
+        if(!LookupTable(con_meta, CHUNKSTORE_TABLE, &hasTable))
+            THROW("LookupTable failed");
 
         std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
 
-        for(int i=0; tables[i] != NULL; i++)
+        if(hasTable)
         {
-            std::unique_ptr<sql::ResultSet> res(stmt->executeQuery(sql::SQLString("DESCRIBE ") + tables[i]));
-
-            if(res->rowsCount() > 0)
-            {
-                // Table exists
-                char buf[256] = {0};
-                const char* separator = "+...........................+......................+";
+            WriteToLog(LOG_INFO, MODULE_NAME ": The table '" CHUNKSTORE_TABLE "' exists.");
 
-                WriteToLog(LOG_INFO, MODULE_NAME ": Table '" + std::string(tables[i]) + "':");
-                WriteToLog(LOG_INFO, separator);
-                sprintf(buf, "| %-25s | %-20s |", "Field", "Type");
-                WriteToLog(LOG_INFO, buf);
-                WriteToLog(LOG_INFO, separator);
+            std::unique_ptr<sql::ResultSet> res(stmt->executeQuery("SHOW COLUMNS FROM " CHUNKSTORE_TABLE " LIKE 'data'"));
+            if(!res->next())
+                THROW("The table '" CHUNKSTORE_TABLE "' has no data column");
 
-                while(res->next())
-                {
-                    sprintf(buf, "| %-25s | %-20s |", res->getString("Field").c_str(), res->getString("Type").c_str());
-                    WriteToLog(LOG_INFO, buf);
-                }
+            std::string type = res->getString("Type");
+            size_t max_size = 255; // TINYBLOB
 
-                WriteToLog(LOG_INFO, separator);
+            for(size_t i = 0; i < BLOB_TYPES_COUNT; i++)
+            {
+                if(strcasecmp(type.c_str(), BLOB_TYPES[i].type) == 0)
+                    max_size = BLOB_TYPES[i].max_size;
             }
-            else
+
+            if(mOptions.dedup && mOptions.chunk_size + CHUNK_FRAME_HEADER_SIZE > max_size)
             {
-                // Table does not yet exist
-                WriteToLog(LOG_INFO, MODULE_NAME ": Table '" + std::string(tables[i]) + "' does not exist.");
+                std::stringstream msg;
+                msg << MODULE_NAME ": chunk size " << mOptions.chunk_size << " exceeds the '"
+                    << CHUNKSTORE_TABLE << "' data column type " << type << ", using " << max_size - CHUNK_FRAME_HEADER_SIZE;
+                WriteToLog(LOG_INFO, msg);
+
+                mOptions.chunk_size = max_size - CHUNK_FRAME_HEADER_SIZE;
             }
         }
+        else
+        {
+            WriteToLog(LOG_INFO, MODULE_NAME ": The table '" CHUNKSTORE_TABLE "' does not exist. Create...");
+
+            // Use the smallest data column type to fit the chunk frame
+            size_t i = 0;
+            while(i < BLOB_TYPES_COUNT - 1 && mOptions.chunk_size + CHUNK_FRAME_HEADER_SIZE > BLOB_TYPES[i].max_size)
+                i++;
+
+            if(mOptions.dedup && mOptions.chunk_size + CHUNK_FRAME_HEADER_SIZE > BLOB_TYPES[i].max_size)
+                mOptions.chunk_size = BLOB_TYPES[i].max_size - CHUNK_FRAME_HEADER_SIZE;
+
+            sql::SQLString sql = "CREATE TABLE IF NOT EXISTS " CHUNKSTORE_TABLE " ("
+                                 "hash BINARY(32) NOT NULL, "
+                                 "refcount INT UNSIGNED NOT NULL DEFAULT '0', "
+                                 "data " + std::string(BLOB_TYPES[i].type) + " NOT NULL, "
+                                 "PRIMARY KEY(hash)) ENGINE=" DB_ENGINE;
+
+            WriteToLog(LOG_INFO, sql);
+            stmt->execute(sql);
+
+            WriteToLog(LOG_INFO, MODULE_NAME ": The table '" CHUNKSTORE_TABLE "' created.");
+        }
+
+        if(!LookupTable(con_meta, STREAMCHUNK_TABLE, &hasTable))
+            THROW("LookupTable failed");
+
+        if(hasTable)
+        {
+            WriteToLog(LOG_INFO, MODULE_NAME ": The table '" STREAMCHUNK_TABLE "' exists.");
+        }
+        else
+        {
+            WriteToLog(LOG_INFO, MODULE_NAME ": The table '" STREAMCHUNK_TABLE "' does not exist. Create...");
+
+            // The chunks of the stream are numbered from 1, pos is the offset
+            // of the chunk in the stream data
+            sql::SQLString sql = "CREATE TABLE IF NOT EXISTS " STREAMCHUNK_TABLE " ("
+                                 "masterid BIGINT UNSIGNED NOT NULL DEFAULT '0', "
+                                 "seq INT UNSIGNED NOT NULL DEFAULT '0', "
+                                 "pos BIGINT UNSIGNED NOT NULL DEFAULT '0', "
+                                 "size INT UNSIGNED NOT NULL DEFAULT '0', "
+                                 "hash BINARY(32) NOT NULL, "
+                                 "PRIMARY KEY(masterid, seq)";
+
+            if(!mPartitioned)
+                sql += ", FOREIGN KEY(masterid) REFERENCES " STREAM_TABLE "(id) ON DELETE CASCADE";
+
+            sql += ") ENGINE=" DB_ENGINE;
+
+            WriteToLog(LOG_INFO, sql);
+            stmt->execute(sql);
+
+            WriteToLog(LOG_INFO, MODULE_NAME ": The table '" STREAMCHUNK_TABLE "' created.");
+        }
 
         return true;
     }
@@ -369,222 +714,1736 @@ bool MySqlStream::Describe()
     return false;
 }
 
-bool MySqlStream::Write(const StreamHeader* hdr, const unsigned char* data)
-{
-    if(hdr == NULL)
-        THROW("StreamHeader* hdr is NULL");
-    if(data == NULL)
-        THROW("data is NULL");
-
-    return Write(hdr, StreamBuf(data, hdr->size));
-}
-
-bool MySqlStream::Write(const StreamHeader* hdr, std::istream& data_stream)
+// Find out if the tables are partitioned and add the partitions
+// ahead of the writes. Both tables always have the same partitions.
+bool MySqlStream::InitPartitions()
 {
     TRY
     {
-        if(hdr == NULL)
-            THROW("StreamHeader* hdr is NULL");
-
-        // Disable autocommit as we are going to change into transaction mode
-        mCon->setAutoCommit(false);
+        std::vector<uint64_t> bounds;
+        if(!GetPartitions(STREAM_TABLE, &bounds))
+            THROW("GetPartitions failed");
 
-        // Insert master stream record into stream table
-        std::unique_ptr<sql::Statement> tran_stmt(mCon->createStatement());
+        mPartitioned = !bounds.empty();
+        if(!mPartitioned)
+        {
+            if(mOptions.partition_size > 0)
+                WriteToLog(LOG_INFO, MODULE_NAME ": The existing tables are not partitioned, partition size is ignored");
+            return true;
+        }
 
-        char sql[256] = {0};
-        sprintf(sql, "INSERT INTO " STREAM_TABLE " (descr, type, timestamp) VALUES ('%s', %hhu, %llu)",
-                hdr->descr, hdr->type, (long long unsigned int)hdr->timestamp);
-        tran_stmt->execute(sql);
+        // Keep partitioning the existing tables the way they are
+        if(mOptions.partition_size == 0)
+            mOptions.partition_size = (bounds.size() > 1 ? bounds[bounds.size() - 1] - bounds[bounds.size() - 2] : bounds[0]);
 
-        // Get the id of the just inserted stream record
-        std::unique_ptr<sql::ResultSet> res(tran_stmt->executeQuery("SELECT LAST_INSERT_ID()"));
-        if(res->rowsCount() == 0)
-            THROW("Statement::executeQuery failed for LAST_INSERT_ID()");
+        if(mOptions.partition_size == 0)
+            THROW("Unknown partition size of the existing tables");
 
+        std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
+        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery("SELECT IFNULL(MAX(id), 0) FROM " STREAM_TABLE));
         if(!res->next())
             THROW("ResultSet::next failed");
 
-        uint64_t master_id = res->getUInt64(1);
-
-        // We are going to use Prepared Statement to insert stream data
-        std::unique_ptr<sql::PreparedStatement> data_stmt(mCon->prepareStatement(
-                "INSERT INTO " STREAMDATA_TABLE " (masterid, data) VALUES (?,?)"));
+        uint64_t id_max = res->getUInt64(1);
+        uint64_t top = bounds.back(); // The last bound but MAXVALUE
+        uint64_t ahead = id_max + mOptions.partition_size * PARTITIONS_AHEAD;
 
-        // Note: The maximum length of the BLOB column is 65535 (2^16-1) bytes
-        uint64_t size_total = 0;
+        if(top > ahead)
+            return true;
 
-        while(data_stream)
+        // Split the new partitions off the MAXVALUE one, it is
+        // expected to be empty, so no rows have to be moved
+        std::stringstream parts;
+        parts << "REORGANIZE PARTITION pmax INTO (";
+        while(top <= ahead)
         {
-            data_stream.read((char*)mBuf, sizeof(mBuf));
-            size_t size_read = data_stream.gcount();
-            size_total += size_read;
-            //std::cout << "size_read=" << size_read << ", size_total=" << size_total << std::endl;
-
-            if(size_read > 0)
-            {
-                data_stmt->setUInt64(1, master_id);
-                data_stmt->setBlob(2, StreamBuf(mBuf, size_read));
-                data_stmt->executeUpdate();
-            }
+            top += mOptions.partition_size;
+            parts << "PARTITION p" << top << " VALUES LESS THAN (" << top << "), ";
         }
+        parts << "PARTITION pmax VALUES LESS THAN MAXVALUE)";
 
-        // Update master stream record with actual data size
-        sprintf(sql, "UPDATE " STREAM_TABLE " SET size=%llu WHERE id=%llu", 
-            (long long unsigned int)size_total, (long long unsigned int)master_id);
-        tran_stmt->execute(sql);
+        std::string sql = "ALTER TABLE " STREAM_TABLE " " + parts.str();
+        WriteToLog(LOG_INFO, sql);
+        stmt->execute(sql);
 
-        mCon->commit();
+        sql = "ALTER TABLE " STREAMDATA_TABLE " " + parts.str();
+        WriteToLog(LOG_INFO, sql);
+        stmt->execute(sql);
 
-        hdr->id = master_id;
         return true;
     }
     CATCH
-    
-    mCon->rollback();
 
     return false;
 }
 
-bool MySqlStream::ReadById(uint64_t id_first, bool inclusive_first,
-                               uint64_t id_last,  bool inclusive_last)
+// Get the upper bounds of the table partitions in ascending order. The
+// MAXVALUE partition is reported as bound 0, and there are no bounds at
+// all if the table is not partitioned.
+bool MySqlStream::GetPartitions(const char* table, std::vector<uint64_t>* bounds)
 {
-    return Read("id", id_first, inclusive_first, id_last, inclusive_last);
+    TRY
+    {
+        std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
+        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery(
+            "SELECT PARTITION_DESCRIPTION FROM INFORMATION_SCHEMA.PARTITIONS "
+            "WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = '" + std::string(table) + "' "
+            "AND PARTITION_NAME IS NOT NULL ORDER BY PARTITION_ORDINAL_POSITION"));
+
+        bounds->clear();
+        while(res->next())
+        {
+            std::string descr = res->getString(1);
+            bounds->push_back(descr == "MAXVALUE" ? 0 : strtoull(descr.c_str(), NULL, 10));
+        }
+
+        // The last partition is MAXVALUE one
+        if(!bounds->empty())
+            bounds->pop_back();
+        if(bounds->empty() && res->rowsCount() > 0)
+            bounds->push_back(0);
+
+        return true;
+    }
+    CATCH
+
+    return false;
 }
 
-bool MySqlStream::Read(const char* column,
-                           uint64_t first, bool inclusive_first,
-                           uint64_t last,  bool inclusive_last)
+bool MySqlStream::DropExpired(uint64_t timestamp_before)
 {
-    // Note: We are going to lock tables while reading. Let's limit the number
-    // of read streams per query to make sure that Write() is not blocked while
-    // we're reading.
-    size_t limit = STREAMS_PER_QUERY; // Number of streams to read per query
-
     TRY
     {
-        if(mReader == NULL)
-            THROW("mReader is NULL");
-        if(column == NULL)
-            THROW("column is NULL");
+        if(!mPartitioned)
+            THROW("The tables are not partitioned");
 
-        while(true)
+        std::vector<uint64_t> bounds;
+        if(!GetPartitions(STREAM_TABLE, &bounds))
+            THROW("GetPartitions failed");
+
+        std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
+        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery("SELECT IFNULL(MAX(id), 0) FROM " STREAM_TABLE));
+        if(!res->next())
+            THROW("ResultSet::next failed");
+
+        uint64_t id_max = res->getUInt64(1);
+
+        // Drop what the run that failed half way left behind
+        if(!bounds.empty() && bounds[0] > 0)
+            DropOrphans(stmt.get(), bounds[0]);
+
+        for(size_t i = 0; i < bounds.size(); i++)
         {
-            // Format SQL query string
+            uint64_t bound = bounds[i];
+
+            // Never drop the partition still being written into
+            if(bound == 0 || bound > id_max)
+                break;
+
             char sql[256] = {0};
-            const char* more = (inclusive_first ? ">=" : ">");
+            sprintf(sql, "SELECT IFNULL(MAX(timestamp), 0) FROM " STREAM_TABLE " PARTITION (p%llu)",
+                (long long unsigned int)bound);
+            res.reset(stmt->executeQuery(sql));
+            if(!res->next())
+                THROW("ResultSet::next failed");
+
+            // Stop at the first partition with stream not yet expired
+            if(res->getUInt64(1) >= timestamp_before)
+                break;
+
+            // Drop the streams first, so there is no stream left without its
+            // data or shared chunks. If dropping the rest fails, the orphaned
+            // data is harmless and dropped by the next run.
+            sprintf(sql, "ALTER TABLE " STREAM_TABLE " DROP PARTITION p%llu", (long long unsigned int)bound);
+            WriteToLog(LOG_INFO, sql);
+            stmt->execute(sql);
+
+            // The MAXVALUE partition is never dropped, so there is the next one
+            DropOrphans(stmt.get(), bounds[i + 1]);
+        }
+
+        // Keep the partitions ahead of the writes
+        if(!InitPartitions())
+            THROW("InitPartitions failed");
+
+        return true;
+    }
+    CATCH
+
+    return false;
+}
+
+// Convert the data table keyed by the chunk id to the one keyed by (masterid,
+// seq). The chunks are numbered in the id order first, so the migration
+// that failed half way can be run again.
+bool MySqlStream::MigrateLayout()
+{
+    TRY
+    {
+        if(mClustered)
+        {
+            WriteToLog(LOG_INFO, MODULE_NAME ": The table '" STREAMDATA_TABLE "' has the data chunks keyed by (masterid, seq) already");
+            return true;
+        }
+
+        std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
+
+        // Acquire WRITE lock even in the snapshot mode, no stream can be
+        // written or read while the chunks are renumbered
+        SqlLockWrite lock(stmt, DB_STREAM_LOCK_TABLES);
+
+        if(!InitColumn(STREAMDATA_TABLE, "seq", "INT UNSIGNED NOT NULL DEFAULT '0'"))
+            THROW("InitColumn failed");
+
+        // Number the chunks of every stream from 1 in the id order. The (masterid)
+        // index has the rows in (masterid, id) order already, so there is no sort.
+        WriteToLog(LOG_INFO, MODULE_NAME ": Numbering the data chunks...");
+        stmt->execute("SET @masterid := 0, @seq := 0");
+        stmt->execute("UPDATE " STREAMDATA_TABLE " SET seq = "
+                      "IF(masterid = @masterid, @seq := @seq + 1, @seq := 1 + 0 * (@masterid := masterid)) "
+                      "ORDER BY masterid, id");
+
+        // Rebuild the table clustered by the new key
+        std::string sql = "ALTER TABLE " STREAMDATA_TABLE " DROP PRIMARY KEY, DROP COLUMN id, ADD PRIMARY KEY(masterid, seq)";
+        WriteToLog(LOG_INFO, sql);
+        stmt->execute(sql);
+
+        // The primary key covers the masterid lookups (and the foreign key) now
+        std::vector<std::string> indexes;
+        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery(
+            "SHOW INDEX FROM " STREAMDATA_TABLE " WHERE Key_name <> 'PRIMARY' AND Column_name = 'masterid' AND Seq_in_index = 1"));
+        while(res->next())
+            indexes.push_back(res->getString("Key_name"));
+
+        for(const std::string& index : indexes)
+        {
+            sql = "ALTER TABLE " STREAMDATA_TABLE " DROP INDEX `" + index + "`";
+            WriteToLog(LOG_INFO, sql);
+            stmt->execute(sql);
+        }
+
+        // The statements prepared for the old layout are no good anymore
+        mStatements.clear();
+        mClustered = true;
+
+        WriteToLog(LOG_INFO, MODULE_NAME ": The table '" STREAMDATA_TABLE "' migrated.");
+        return true;
+    }
+    CATCH
+
+    return false;
+}
+
+bool MySqlStream::InitWriteBatch()
+{
+    TRY
+    {
+        // The whole multi-row INSERT must fit into the server max_allowed_packet,
+        // leave some room for the statement itself and the master ids
+        std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
+        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery("SELECT @@max_allowed_packet"));
+        if(!res->next())
+            THROW("ResultSet::next failed");
+
+        uint64_t max_packet = res->getUInt64(1);
+        uint64_t batch_size = mOptions.write_batch_size;
+
+        if(mOptions.chunk_size + 1024 > max_packet)
+        {
+            std::stringstream msg;
+            msg << MODULE_NAME ": chunk size " << mOptions.chunk_size
+                << " exceeds max_allowed_packet = " << max_packet << ", using " << max_packet - 1024;
+            WriteToLog(LOG_INFO, msg);
+
+            mOptions.chunk_size = max_packet - 1024;
+        }
+
+        if(batch_size + 1024 > max_packet)
+            batch_size = (max_packet > 1024 ? max_packet - 1024 : 0);
+
+        mBatchRows = batch_size / mOptions.chunk_size;
+        if(mBatchRows == 0)
+            mBatchRows = 1;
+
+        std::stringstream msg;
+        msg << MODULE_NAME ": max_allowed_packet = " << max_packet
+            << ", data chunks per INSERT = " << mBatchRows;
+        WriteToLog(LOG_INFO, msg);
+
+        return true;
+    }
+    CATCH
+
+    return false;
+}
+
+bool MySqlStream::Describe()
+{
+    TRY
+    {
+        // Describe the actual table (if exists)
+        const char* tables[] = { STREAM_TABLE, STREAMDATA_TABLE, STREAMCHUNK_TABLE, CHUNKSTORE_TABLE, NULL };
+
+        std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
+
+        for(int i=0; tables[i] != NULL; i++)
+        {
+            std::unique_ptr<sql::ResultSet> res(stmt->executeQuery(sql::SQLString("DESCRIBE ") + tables[i]));
+
+            if(res->rowsCount() > 0)
+            {
+                // Table exists
+                char buf[256] = {0};
+                const char* separator = "+...........................+......................+";
+
+                WriteToLog(LOG_INFO, MODULE_NAME ": Table '" + std::string(tables[i]) + "':");
+                WriteToLog(LOG_INFO, separator);
+                sprintf(buf, "| %-25s | %-20s |", "Field", "Type");
+                WriteToLog(LOG_INFO, buf);
+                WriteToLog(LOG_INFO, separator);
+
+                while(res->next())
+                {
+                    sprintf(buf, "| %-25s | %-20s |", res->getString("Field").c_str(), res->getString("Type").c_str());
+                    WriteToLog(LOG_INFO, buf);
+                }
+
+                WriteToLog(LOG_INFO, separator);
+            }
+            else
+            {
+                // Table does not yet exist
+                WriteToLog(LOG_INFO, MODULE_NAME ": Table '" + std::string(tables[i]) + "' does not exist.");
+            }
+        }
+
+        return true;
+    }
+    CATCH
+
+    return false;
+}
+
+bool MySqlStream::Write(const StreamHeader* hdr, const unsigned char* data)
+{
+    TRY
+    {
+        if(hdr == NULL)
+            THROW("StreamHeader* hdr is NULL");
+        if(data == NULL && hdr->size > 0)
+            THROW("data is NULL");
+
+        // Disable autocommit as we are going to change into transaction mode
+        mCon->setAutoCommit(false);
+
+        uint64_t master_id = WriteStream(hdr, data);
+
+        mCon->commit();
+        NotifyCommit();
+
+        hdr->id = master_id;
+        return true;
+    }
+    CATCH
+
+    mCon->rollback();
+
+    return false;
+}
+
+bool MySqlStream::Write(const StreamHeader* hdr, std::istream& data_stream)
+{
+    TRY
+    {
+        if(hdr == NULL)
+            THROW("StreamHeader* hdr is NULL");
+
+        // Disable autocommit as we are going to change into transaction mode
+        mCon->setAutoCommit(false);
+
+        uint64_t master_id = WriteStream(hdr, data_stream);
+
+        mCon->commit();
+        NotifyCommit();
+
+        hdr->id = master_id;
+        return true;
+    }
+    CATCH
+    
+    mCon->rollback();
+
+    return false;
+}
+
+bool MySqlStream::Open(const StreamHeader* hdr)
+{
+    TRY
+    {
+        if(hdr == NULL)
+            THROW("StreamHeader* hdr is NULL");
+
+        // Disable autocommit as we are going to change into transaction mode
+        mCon->setAutoCommit(false);
+
+        uint64_t master_id = InsertStream(hdr, true);
+
+        mCon->commit();
+        NotifyCommit();
+
+        hdr->id = master_id;
+        return true;
+    }
+    CATCH
+
+    mCon->rollback();
+
+    return false;
+}
+
+// Append the data to the open stream in its own transaction. The partial last
+// chunk is filled up first, so all chunks but the last stay chunksize bytes.
+bool MySqlStream::Append(const StreamHeader* hdr, const unsigned char* data, size_t size)
+{
+    TRY
+    {
+        if(hdr == NULL)
+            THROW("StreamHeader* hdr is NULL");
+        if(data == NULL && size > 0)
+            THROW("data is NULL");
+
+        // Disable autocommit as we are going to change into transaction mode
+        mCon->setAutoCommit(false);
+
+        // Lock the stream record against the other appenders
+        std::unique_ptr<sql::ResultSet> res(Query(
+            "SELECT size, chunksize, format, state FROM " STREAM_TABLE " WHERE id = ? FOR UPDATE", { hdr->id }));
+        if(!res->next())
+            THROW("The stream is not found");
+
+        uint64_t stream_size = res->getUInt64("size");
+        uint64_t chunk_size = res->getUInt("chunksize");
+        uint8_t format = (uint8_t)res->getUInt("format");
+        uint8_t state = (uint8_t)res->getUInt("state");
+        res.reset();
+
+        if(state != STREAM_STATE_OPEN)
+            THROW("The stream is not open");
+
+        // The chunks are sliced and framed by the stream options
+        if(chunk_size != mOptions.chunk_size ||
+           format != (IsFramed() ? STREAM_FORMAT_FRAMED : STREAM_FORMAT_RAW))
+            THROW("The stream was opened with another chunk size, codec or checksum");
+
+        size_t offset = 0;
+
+        if(stream_size % chunk_size > 0 && size > 0)
+        {
+            // Rewrite the partial last chunk with the data appended to it
+            res.reset(Query(mClustered ?
+                "SELECT seq AS id, data FROM " STREAMDATA_TABLE " WHERE masterid = ? ORDER BY seq DESC LIMIT 1" :
+                "SELECT id, data FROM " STREAMDATA_TABLE " WHERE masterid = ? ORDER BY id DESC LIMIT 1", { hdr->id }));
+            if(!res->next())
+                THROW("The last data chunk is not found");
+
+            uint64_t chunk_id = res->getUInt64("id");
+            std::string chunk = res->getString("data");
+            res.reset();
+
+            if(format == STREAM_FORMAT_FRAMED)
+            {
+                const unsigned char* decoded = NULL;
+                size_t decoded_size = 0;
+                if(!ChunkCodec::Decode((const unsigned char*)chunk.data(), chunk.size(), chunk_size, mDecodeBuf, &decoded, &decoded_size))
+                    THROW("Invalid data chunk frame or checksum mismatch");
+
+                chunk.assign((const char*)decoded, decoded_size);
+            }
+
+            offset = std::min<uint64_t>(size, chunk_size - chunk.size());
+            chunk.append((const char*)data, offset);
+
+            const unsigned char* chunk_data = (const unsigned char*)chunk.data();
+            size_t chunk_data_size = chunk.size();
+            if(format == STREAM_FORMAT_FRAMED)
+            {
+                if(mFrameBuf.size() < chunk.size() + CHUNK_FRAME_HEADER_SIZE)
+                    mFrameBuf.resize(chunk.size() + CHUNK_FRAME_HEADER_SIZE);
+
+                chunk_data_size = ChunkCodec::Encode(mOptions.codec, mOptions.checksum, chunk_data, chunk_data_size, &mFrameBuf[0]);
+                chunk_data = &mFrameBuf[0];
+            }
+
+            sql::PreparedStatement* stmt = Prepare(mClustered ?
+                "UPDATE " STREAMDATA_TABLE " SET data = ? WHERE masterid = ? AND seq = ?" :
+                "UPDATE " STREAMDATA_TABLE " SET data = ? WHERE masterid = ? AND id = ?");
+
+            StreamBuf blob(chunk_data, chunk_data_size);
+            stmt->setBlob(1, blob);
+            stmt->setUInt64(2, hdr->id);
+            stmt->setUInt64(3, chunk_id);
+            stmt->executeUpdate();
+        }
+
+        // The rest of the data goes into the new chunks
+        InsertData(hdr->id, (uint32_t)((stream_size + offset) / chunk_size + 1), data + offset, size - offset);
+
+        sql::PreparedStatement* stmt = Prepare("UPDATE " STREAM_TABLE " SET size = ? WHERE id = ? AND state = ?");
+        stmt->setUInt64(1, stream_size + size);
+        stmt->setUInt64(2, hdr->id);
+        stmt->setUInt(3, STREAM_STATE_OPEN);
+        if(stmt->executeUpdate() != 1)
+            THROW("The stream is not open");
+
+        mCon->commit();
+        NotifyCommit();
+
+        return true;
+    }
+    CATCH
+
+    mCon->rollback();
+
+    return false;
+}
+
+bool MySqlStream::Seal(const StreamHeader* hdr)
+{
+    TRY
+    {
+        if(hdr == NULL)
+            THROW("StreamHeader* hdr is NULL");
+
+        // Disable autocommit as we are going to change into transaction mode
+        mCon->setAutoCommit(false);
+
+        // Only the open stream is sealed, once
+        sql::PreparedStatement* stmt = Prepare("UPDATE " STREAM_TABLE " SET state = ? WHERE id = ? AND state = ?");
+        stmt->setUInt(1, STREAM_STATE_SEALED);
+        stmt->setUInt64(2, hdr->id);
+        stmt->setUInt(3, STREAM_STATE_OPEN);
+        if(stmt->executeUpdate() == 0)
+            THROW("The stream is not found or not open");
+
+        mCon->commit();
+        NotifyCommit();
+
+        return true;
+    }
+    CATCH
+
+    mCon->rollback();
+
+    return false;
+}
+
+bool MySqlStream::WriteBatch(const StreamHeader* hdrs, const unsigned char* const* data, size_t count)
+{
+    TRY
+    {
+        if(hdrs == NULL || data == NULL)
+            THROW("StreamHeader* hdrs or data is NULL");
+
+        // Disable autocommit as we are going to change into transaction mode
+        mCon->setAutoCommit(false);
+
+        // Write up to group_commit_size streams per transaction, so all
+        // of them share a single commit
+        size_t group_size = (mOptions.group_commit_size > 0 ? mOptions.group_commit_size : 1);
+        std::vector<uint64_t> master_ids;
+
+        for(size_t first = 0; first < count; first += group_size)
+        {
+            size_t last = std::min(count, first + group_size);
+            master_ids.clear();
+
+            for(size_t i = first; i < last; i++)
+            {
+                if(data[i] == NULL && hdrs[i].size > 0)
+                    THROW("data is NULL");
+
+                master_ids.push_back(WriteStream(&hdrs[i], data[i]));
+            }
+
+            mCon->commit();
+            NotifyCommit();
+
+            for(size_t i = first; i < last; i++)
+                hdrs[i].id = master_ids[i - first];
+        }
+
+        return true;
+    }
+    CATCH
+
+    mCon->rollback();
+
+    return false;
+}
+
+// Write the stream within the current transaction and return its id.
+// Note: Throws on failure, so must be called from within TRY block.
+uint64_t MySqlStream::WriteStream(const StreamHeader* hdr, std::istream& data_stream)
+{
+    uint64_t master_id = InsertStream(hdr);
+    uint64_t size_total = 0;
+
+    if(mOptions.dedup)
+    {
+        size_total = InsertSharedData(master_id, data_stream);
+    }
+    else
+    {
+        // Read up to mBatchRows chunks and insert all of them at once
+        std::vector<size_t> sizes;
+        uint32_t seq = 1;
+
+        const size_t chunk_size = mOptions.chunk_size;
+        mBatchBuf.resize(mBatchRows * chunk_size);
+
+        while(data_stream)
+        {
+            data_stream.read((char*)&mBatchBuf[sizes.size() * chunk_size], chunk_size);
+            size_t size_read = data_stream.gcount();
+            size_total += size_read;
+            //std::cout << "size_read=" << size_read << ", size_total=" << size_total << std::endl;
+
+            if(size_read > 0)
+                sizes.push_back(size_read);
+
+            if(sizes.size() == mBatchRows)
+            {
+                InsertChunks(master_id, seq, &mBatchBuf[0], sizes);
+                seq += sizes.size();
+                sizes.clear();
+            }
+        }
+
+        if(!sizes.empty())
+            InsertChunks(master_id, seq, &mBatchBuf[0], sizes);
+    }
+
+    // Update master stream record with actual data size, unless
+    // the header size was right (the stream size is known up front)
+    if(size_total != hdr->size)
+    {
+        char sql[256] = {0};
+        sprintf(sql, "UPDATE " STREAM_TABLE " SET size=%llu WHERE id=%llu", 
+            (long long unsigned int)size_total, (long long unsigned int)master_id);
+
+        std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
+        stmt->execute(sql);
+    }
+
+    return master_id;
+}
+
+// Write the stream of hdr->size bytes within the current transaction and
+// return its id. The chunks are bound right from the caller buffer, there
+// is no staging copy like for the istream (but for the deduplicated streams).
+// Note: Throws on failure, so must be called from within TRY block.
+uint64_t MySqlStream::WriteStream(const StreamHeader* hdr, const unsigned char* data)
+{
+    // Deduplicated streams are cut by their content
+    if(mOptions.dedup)
+    {
+        StreamBuf buf(data, hdr->size);
+        return WriteStream(hdr, buf);
+    }
+
+    uint64_t master_id = InsertStream(hdr);
+    InsertData(master_id, 1, data, hdr->size);
+
+    return master_id;
+}
+
+// Insert size bytes of data as the chunks numbered from seq, slicing up to
+// mBatchRows chunks of the buffer per INSERT.
+// Note: Throws on failure, so must be called from within TRY block.
+void MySqlStream::InsertData(uint64_t master_id, uint32_t seq, const unsigned char* data, uint64_t size)
+{
+    const size_t chunk_size = mOptions.chunk_size;
+    std::vector<size_t> sizes;
+    uint64_t offset = 0;
+
+    while(offset < size)
+    {
+        uint64_t size_left = size - offset;
+        uint64_t size_batch = 0;
+        sizes.clear();
+
+        while(sizes.size() < mBatchRows && size_batch < size_left)
+        {
+            sizes.push_back(std::min<uint64_t>(chunk_size, size_left - size_batch));
+            size_batch += sizes.back();
+        }
+
+        InsertChunks(master_id, seq, data + offset, sizes);
+        seq += sizes.size();
+        offset += size_batch;
+    }
+}
+
+// Insert master stream record into stream table and return its id.
+// The size is expected to be the header one, or 0 for the open stream.
+// Note: Throws on failure, so must be called from within TRY block.
+uint64_t MySqlStream::InsertStream(const StreamHeader* hdr, bool open /*=false*/)
+{
+    // The open streams are appended chunk by chunk, so they are never deduplicated
+    uint8_t format = (IsFramed() ? STREAM_FORMAT_FRAMED : STREAM_FORMAT_RAW);
+    if(mOptions.dedup && !open)
+        format = STREAM_FORMAT_DEDUP;
+
+    uint8_t state = (open ? STREAM_STATE_OPEN : STREAM_STATE_SEALED);
+
+    sql::PreparedStatement* stmt = Prepare("INSERT INTO " STREAM_TABLE " (descr, type, timestamp, chunksize, format, state, size) "
+                                           "VALUES (?, ?, ?, ?, ?, ?, ?)");
+    stmt->setString(1, hdr->descr != NULL ? hdr->descr : "");
+    stmt->setUInt(2, hdr->type);
+    stmt->setUInt64(3, hdr->timestamp);
+    stmt->setUInt64(4, mOptions.chunk_size);
+    stmt->setUInt(5, format);
+    stmt->setUInt(6, state);
+    stmt->setUInt64(7, open ? 0 : hdr->size);
+    if(stmt->executeUpdate() != 1)
+        THROW("PreparedStatement::executeUpdate failed for stream record");
+
+    // Get the id of the just inserted stream record
+    std::unique_ptr<sql::ResultSet> res(Prepare("SELECT LAST_INSERT_ID()")->executeQuery());
+    if(!res->next())
+        THROW("ResultSet::next failed");
+
+    return res->getUInt64(1);
+}
+
+// Prepare INSERT statement for the given number of data chunks, only the full
+// batch one is cached (see Prepare())
+// Note: Throws on failure, so must be called from within TRY block.
+sql::PreparedStatement* MySqlStream::PrepareInsertChunks(size_t rows, std::unique_ptr<sql::PreparedStatement>& stmt)
+{
+    if(!mClustered)
+    {
+        std::string sql = "INSERT INTO " STREAMDATA_TABLE " (masterid, data) VALUES (?,?)";
+        for(size_t i = 1; i < rows; i++)
+            sql += ",(?,?)";
+
+        return Prepare(sql, rows == mBatchRows, stmt);
+    }
+
+    std::string sql = "INSERT INTO " STREAMDATA_TABLE " (masterid, seq, data) VALUES (?,?,?)";
+    for(size_t i = 1; i < rows; i++)
+        sql += ",(?,?,?)";
+
+    return Prepare(sql, rows == mBatchRows, stmt);
+}
+
+// Get the statement prepared for the SQL. Every statement is prepared
+// once per connection, and then it is reused while the connection is open.
+// Note: Throws on failure, so must be called from within TRY block.
+sql::PreparedStatement* MySqlStream::Prepare(const std::string& sql)
+{
+    std::unique_ptr<sql::PreparedStatement>& stmt = mStatements[sql];
+    if(stmt.get() == NULL)
+        stmt.reset(mCon->prepareStatement(sql));
+
+    return stmt.get();
+}
+
+// Get the statement of the SQL that comes in many shapes, e.g. by the row
+// count. Only the fixed shape is cached (see Prepare()), any other one is
+// prepared into stmt for the single use, so the cache and the statements
+// open on the server stay bounded.
+// Note: Throws on failure, so must be called from within TRY block.
+sql::PreparedStatement* MySqlStream::Prepare(const std::string& sql, bool cached,
+                                             std::unique_ptr<sql::PreparedStatement>& stmt)
+{
+    if(cached)
+        return Prepare(sql);
+
+    stmt.reset(mCon->prepareStatement(sql));
+    return stmt.get();
+}
+
+// Run the query with the parameters in place of '?'. The buffered query uses
+// the prepared statement (see Prepare()). Prepared statements only support
+// buffered result sets, so the unbuffered query is sent as text with the
+// parameters formatted into it.
+// Note: Throws on failure, so must be called from within TRY block.
+sql::ResultSet* MySqlStream::Query(const std::string& sql, const std::vector<uint64_t>& params,
+                                   bool unbuffered /*=false*/)
+{
+    if(!unbuffered)
+    {
+        sql::PreparedStatement* stmt = Prepare(sql);
+        for(size_t i = 0; i < params.size(); i++)
+            stmt->setUInt64(i + 1, params[i]);
+
+        return stmt->executeQuery();
+    }
+
+    std::string text;
+    size_t param = 0;
+    for(char c : sql)
+    {
+        if(c != '?')
+            text += c;
+        else if(param < params.size())
+            text += std::to_string(params[param++]);
+        else
+            THROW("Missing query parameter");
+    }
+
+    if(mQueryStmt.get() == NULL)
+    {
+        mQueryStmt.reset(mCon->createStatement());
+        mQueryStmt->setResultSetType(sql::ResultSet::TYPE_FORWARD_ONLY);
+    }
+
+    return mQueryStmt->executeQuery(text);
+}
+
+// Insert data chunks numbered from seq with a single multi-row INSERT. The
+// chunks are chunk_size bytes apart in the data buffer. With a codec or
+// checksum the chunks are framed into mFrameBuf first (see chunkcodec.h).
+// Note: Throws on failure, so must be called from within TRY block.
+void MySqlStream::InsertChunks(uint64_t master_id, uint32_t seq, const unsigned char* data, const std::vector<size_t>& sizes)
+{
+    std::unique_ptr<sql::PreparedStatement> tail_stmt;
+    sql::PreparedStatement& stmt = *PrepareInsertChunks(sizes.size(), tail_stmt);
+    size_t stride = mOptions.chunk_size;
+
+    std::vector<size_t> frame_sizes;
+    if(IsFramed())
+    {
+        const size_t frame_stride = stride + CHUNK_FRAME_HEADER_SIZE;
+        if(mFrameBuf.size() < sizes.size() * frame_stride)
+            mFrameBuf.resize(sizes.size() * frame_stride);
+
+        frame_sizes.resize(sizes.size());
+        for(size_t i = 0; i < sizes.size(); i++)
+            frame_sizes[i] = ChunkCodec::Encode(mOptions.codec, mOptions.checksum, data + i * stride, sizes[i], &mFrameBuf[i * frame_stride]);
+
+        data = &mFrameBuf[0];
+        stride = frame_stride;
+    }
+
+    const std::vector<size_t>& row_sizes = frame_sizes.empty() ? sizes : frame_sizes;
+
+    // Note: setBlob() keeps the istream pointer until the statement is
+    // executed, so the StreamBuf objects must outlive executeUpdate()
+    std::vector<std::unique_ptr<StreamBuf>> blobs;
+    blobs.reserve(sizes.size());
+
+    for(size_t i = 0; i < sizes.size(); i++)
+    {
+        blobs.emplace_back(new StreamBuf(data + i * stride, row_sizes[i]));
+
+        if(mClustered)
+        {
+            stmt.setUInt64(i * 3 + 1, master_id);
+            stmt.setUInt(i * 3 + 2, seq + i);
+            stmt.setBlob(i * 3 + 3, *blobs.back());
+        }
+        else
+        {
+            stmt.setUInt64(i * 2 + 1, master_id);
+            stmt.setBlob(i * 2 + 2, *blobs.back());
+        }
+    }
+
+    stmt.executeUpdate();
+}
+
+// Cut the data stream into chunks by their content (see chunkdedup.h) and
+// insert up to mBatchRows chunks at once. The data after the last boundary
+// in the buffer is kept for the next round. Returns the data size.
+// Note: Throws on failure, so must be called from within TRY block.
+uint64_t MySqlStream::InsertSharedData(uint64_t master_id, std::istream& data_stream)
+{
+    const size_t chunk_size = mOptions.chunk_size;
+    mBatchBuf.resize(mBatchRows * chunk_size);
+
+    std::vector<size_t> sizes;
+    uint32_t seq = 1;
+    uint64_t pos = 0;       // Offset of the buffer in the stream
+    size_t buf_size = 0;    // Bytes in the buffer
+    bool eof = false;
+
+    while(true)
+    {
+        // Top the buffer up
+        while(!eof && buf_size < mBatchBuf.size())
+        {
+            data_stream.read((char*)&mBatchBuf[buf_size], mBatchBuf.size() - buf_size);
+            buf_size += data_stream.gcount();
+            eof = !data_stream;
+        }
+
+        // The last piece of the buffer without a boundary waits for more data,
+        // unless it is the end of the stream. The full buffer has at least one
+        // chunk_size chunk, so there is always a chunk to insert.
+        size_t cut = 0;
+        sizes.clear();
+
+        while(cut < buf_size)
+        {
+            size_t size = ChunkDedup::Cut(&mBatchBuf[cut], buf_size - cut, chunk_size);
+            if(!eof && cut + size == buf_size && size < chunk_size)
+                break;
+
+            sizes.push_back(size);
+            cut += size;
+        }
+
+        if(!sizes.empty())
+        {
+            InsertSharedChunks(master_id, seq, pos, &mBatchBuf[0], sizes);
+            seq += sizes.size();
+            pos += cut;
+        }
+
+        buf_size -= cut;
+        if(buf_size == 0 && eof)
+            break;
+
+        memmove(&mBatchBuf[0], &mBatchBuf[cut], buf_size);
+    }
+
+    return pos;
+}
+
+// Store the chunks, one after another in the data buffer, as the shared chunks
+// of the stream numbered from seq at the stream offset pos. Every distinct
+// chunk is stored once by its hash, and the stored ones only get their
+// reference count incremented without sending the data again.
+// Note: Throws on failure, so must be called from within TRY block.
+void MySqlStream::InsertSharedChunks(uint64_t master_id, uint32_t seq, uint64_t pos,
+                                     const unsigned char* data, const std::vector<size_t>& sizes)
+{
+    // Hash the chunks, the same chunk can come more than once
+    std::vector<std::string> hashes;
+    std::vector<size_t> offsets;
+    std::map<std::string, size_t> refs;
+    size_t offset = 0;
+
+    for(size_t size : sizes)
+    {
+        hashes.push_back(ChunkDedup::Hash(data + offset, size));
+        offsets.push_back(offset);
+        refs[hashes.back()]++;
+        offset += size;
+    }
+
+    // Find out the stored chunks, and lock them so they are not
+    // deleted before the references are added
+    std::string sql = "SELECT HEX(hash) AS hash FROM " CHUNKSTORE_TABLE " WHERE hash IN (UNHEX(?)";
+    for(size_t i = 1; i < refs.size(); i++)
+        sql += ",UNHEX(?)";
+    sql += ") FOR UPDATE";
+
+    // The statements come in as many shapes as there are chunk counts,
+    // only the ones of the full batch are cached (see Prepare())
+    std::unique_ptr<sql::PreparedStatement> find_stmt, store_stmt, ref_stmt;
+    sql::PreparedStatement* stmt = Prepare(sql, refs.size() == mBatchRows, find_stmt);
+    size_t param = 1;
+    for(const auto& ref : refs)
+        stmt->setString(param++, ref.first);
+
+    std::set<std::string> stored;
+    {
+        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery());
+        while(res->next())
+            stored.insert(res->getString("hash"));
+    }
+
+    // Add the chunks not yet stored and count the references. The chunk
+    // stored by another writer meanwhile only gets the count added.
+    sql = "INSERT INTO " CHUNKSTORE_TABLE " (hash, refcount, data) VALUES (UNHEX(?),?,?)";
+    for(size_t i = 1; i < refs.size(); i++)
+        sql += ",(UNHEX(?),?,?)";
+    sql += " ON DUPLICATE KEY UPDATE refcount = refcount + VALUES(refcount)";
+
+    const size_t frame_stride = mOptions.chunk_size + CHUNK_FRAME_HEADER_SIZE;
+    if(mFrameBuf.size() < refs.size() * frame_stride)
+        mFrameBuf.resize(refs.size() * frame_stride);
+
+    // Note: setBlob() keeps the istream pointer until the statement is
+    // executed, so the StreamBuf objects must outlive executeUpdate()
+    std::vector<std::unique_ptr<StreamBuf>> blobs;
+    blobs.reserve(refs.size());
+    stmt = Prepare(sql, refs.size() == mBatchRows, store_stmt);
+    param = 1;
+
+    for(const auto& ref : refs)
+    {
+        unsigned char* frame = &mFrameBuf[blobs.size() * frame_stride];
+        size_t frame_size = 0;
+
+        if(stored.count(ref.first) == 0)
+        {
+            size_t i = std::find(hashes.begin(), hashes.end(), ref.first) - hashes.begin();
+            frame_size = ChunkCodec::Encode(mOptions.codec, mOptions.checksum, data + offsets[i], sizes[i], frame);
+        }
+
+        blobs.emplace_back(new StreamBuf(frame, frame_size));
+        stmt->setString(param++, ref.first);
+        stmt->setUInt(param++, ref.second);
+        stmt->setBlob(param++, *blobs.back());
+    }
+
+    stmt->executeUpdate();
+
+    // Reference the chunks from the stream
+    sql = "INSERT INTO " STREAMCHUNK_TABLE " (masterid, seq, pos, size, hash) VALUES (?,?,?,?,UNHEX(?))";
+    for(size_t i = 1; i < sizes.size(); i++)
+        sql += ",(?,?,?,?,UNHEX(?))";
+
+    stmt = Prepare(sql, sizes.size() == mBatchRows, ref_stmt);
+    param = 1;
+
+    for(size_t i = 0; i < sizes.size(); i++)
+    {
+        stmt->setUInt64(param++, master_id);
+        stmt->setUInt(param++, seq + i);
+        stmt->setUInt64(param++, pos + offsets[i]);
+        stmt->setUInt(param++, sizes[i]);
+        stmt->setString(param++, hashes[i]);
+    }
+
+    stmt->executeUpdate();
+}
+
+// Release the shared chunks referenced by the streams matching the condition
+// on the stream table, before the streams are deleted in the same transaction.
+// The chunks no stream refers to anymore are deleted. The condition may also
+// match the references of the streams gone already (no stream table row).
+// Note: Throws on failure, so must be called from within TRY block.
+void MySqlStream::ReleaseChunks(sql::Statement* stmt, const std::string& where)
+{
+    std::string refs = "(SELECT " STREAMCHUNK_TABLE ".hash, COUNT(*) AS refs FROM " STREAMCHUNK_TABLE
+                       " LEFT JOIN " STREAM_TABLE " ON " STREAM_TABLE ".id = " STREAMCHUNK_TABLE ".masterid"
+                       " WHERE " + where + " GROUP BY " STREAMCHUNK_TABLE ".hash) AS refs";
+
+    stmt->execute("UPDATE " CHUNKSTORE_TABLE " JOIN " + refs + " ON " CHUNKSTORE_TABLE ".hash = refs.hash"
+                  " SET " CHUNKSTORE_TABLE ".refcount = " CHUNKSTORE_TABLE ".refcount - refs.refs");
+
+    stmt->execute("DELETE " CHUNKSTORE_TABLE " FROM " CHUNKSTORE_TABLE " JOIN " + refs +
+                  " ON " CHUNKSTORE_TABLE ".hash = refs.hash WHERE " CHUNKSTORE_TABLE ".refcount = 0");
+}
+
+// Drop the data partitions and release the shared chunks of the streams
+// whose stream partitions were dropped by DropExpired(), the ones below the
+// first stream partition left (of upper bound, 0 for MAXVALUE one)
+// Note: Throws on failure, so must be called from within TRY block.
+void MySqlStream::DropOrphans(sql::Statement* stmt, uint64_t bound)
+{
+    // The shared chunk references of the streams gone
+    char where[256] = {0};
+    if(bound > 0)
+        sprintf(where, STREAMCHUNK_TABLE ".masterid < %llu AND " STREAM_TABLE ".id IS NULL", (long long unsigned int)bound);
+    else
+        strcpy(where, STREAM_TABLE ".id IS NULL");
+
+    {
+        SqlTransaction tran(mCon.get());
+
+        ReleaseChunks(stmt, where);
+        stmt->execute(std::string("DELETE " STREAMCHUNK_TABLE " FROM " STREAMCHUNK_TABLE " LEFT JOIN " STREAM_TABLE
+                                  " ON " STREAM_TABLE ".id = " STREAMCHUNK_TABLE ".masterid WHERE ") + where);
+        tran.Commit();
+    }
+
+    std::vector<uint64_t> bounds;
+    if(!GetPartitions(STREAMDATA_TABLE, &bounds))
+        THROW("GetPartitions failed");
+
+    for(uint64_t data_bound : bounds)
+    {
+        if(data_bound == 0 || (bound > 0 && data_bound >= bound))
+            break;
+
+        char sql[256] = {0};
+        sprintf(sql, "ALTER TABLE " STREAMDATA_TABLE " DROP PARTITION p%llu", (long long unsigned int)data_bound);
+        WriteToLog(LOG_INFO, sql);
+        stmt->execute(sql);
+    }
+}
+
+bool MySqlStream::ReadById(uint64_t id_first, bool inclusive_first,
+                               uint64_t id_last,  bool inclusive_last)
+{
+    return Read("id", id_first, inclusive_first, id_last, inclusive_last);
+}
+
+bool MySqlStream::ReadByTimestamp(uint64_t timestamp_first, bool inclusive_first,
+                                  uint64_t timestamp_last,  bool inclusive_last)
+{
+    return Read("timestamp", timestamp_first, inclusive_first, timestamp_last, inclusive_last);
+}
+
+bool MySqlStream::ReadRange(uint64_t id, uint64_t offset, uint64_t size, bool* found)
+{
+    TRY
+    {
+        if(mReader == NULL)
+            THROW("mReader is NULL");
+        if(found == NULL)
+            THROW("bool* found is NULL");
+
+        // Acquire READ lock to block the deletion while reading is in progress
+        std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
+        SqlLockRead lock(stmt, mOptions.lock_mode);
+
+        std::unique_ptr<sql::ResultSet> res(Query(
+            "SELECT id, descr, type, size, timestamp, chunksize, format FROM " STREAM_TABLE " WHERE id = ?", { id }));
+
+        *found = res->next();
+        if(!*found)
+            return true;
+
+        StreamHeader hdr;
+        hdr.id = res->getUInt64("id");
+        hdr.type = (uint8_t)res->getUInt("type");
+        hdr.size = res->getUInt64("size");
+        hdr.timestamp = res->getUInt64("timestamp");
+
+        sql::SQLString descr = res->getString("descr");
+        hdr.descr = descr.c_str();
+
+        uint64_t chunk_size = res->getUInt("chunksize");
+        uint8_t format = (uint8_t)res->getUInt("format");
+        if(chunk_size == 0)
+            THROW("Invalid chunk size of the stream");
+
+        // Clip the range to the stream data
+        uint64_t end = hdr.size;
+        if(offset > end)
+            offset = end;
+        if(size > 0 && size < end - offset)
+            end = offset + size;
+
+        bool keepReading = mReader->OnRead(&hdr, mBuf.data(), 0, DB_STREAM_READ_BEGIN);
+
+        if(keepReading)
+            keepReading = ReadRangeData(hdr, format, chunk_size, offset, end);
+
+        mReader->OnRead(&hdr, mBuf.data(), 0, DB_STREAM_READ_END);
+        return true;
+    }
+    CATCH
+
+    return false;
+}
+
+// Pass the stream data bytes [offset, end) to the reader.
+// Returns false if reading was stopped by caller.
+// Note: Throws on failure, so must be called from within TRY block.
+bool MySqlStream::ReadRangeData(const StreamHeader& hdr, uint8_t format, uint64_t chunk_size,
+                                uint64_t offset, uint64_t end)
+{
+    if(offset >= end)
+        return true;
+
+    // Every chunk but the last one is chunksize bytes, so the range chunks
+    // are found by their number. The chunks keyed by id (see mClustered)
+    // can only be counted off in id order. The shared chunks of the
+    // deduplicated stream are found by their offset.
+    uint64_t chunk_first = offset / chunk_size;
+    uint64_t chunk_last = (end - 1) / chunk_size;
+    std::unique_ptr<sql::ResultSet> res;
+
+    if(format == STREAM_FORMAT_DEDUP)
+        res.reset(Query("SELECT " STREAMCHUNK_TABLE ".pos, " CHUNKSTORE_TABLE ".data FROM " STREAMCHUNK_TABLE
+                        " JOIN " CHUNKSTORE_TABLE " ON " CHUNKSTORE_TABLE ".hash = " STREAMCHUNK_TABLE ".hash"
+                        " WHERE " STREAMCHUNK_TABLE ".masterid = ? AND " STREAMCHUNK_TABLE ".pos < ?"
+                        " AND " STREAMCHUNK_TABLE ".pos + " STREAMCHUNK_TABLE ".size > ? ORDER BY " STREAMCHUNK_TABLE ".seq",
+                        { hdr.id, end, offset }, mOptions.read_unbuffered));
+    else if(mClustered)
+        res.reset(Query("SELECT data FROM " STREAMDATA_TABLE " WHERE masterid = ? AND seq BETWEEN ? AND ? ORDER BY seq",
+                        { hdr.id, chunk_first + 1, chunk_last + 1 }, mOptions.read_unbuffered));
+    else
+        res.reset(Query("SELECT data FROM " STREAMDATA_TABLE " WHERE masterid = ? ORDER BY id LIMIT ?, ?",
+                        { hdr.id, chunk_first, chunk_last - chunk_first + 1 }, mOptions.read_unbuffered));
+
+    uint64_t pos = chunk_first * chunk_size; // Offset of the current chunk
+    bool keepReading = true;
+
+    while(keepReading && res->next())
+    {
+        if(format == STREAM_FORMAT_DEDUP)
+            pos = res->getUInt64("pos");
+
+        sql::SQLString blob = res->getString("data");
+        const unsigned char* data = (const unsigned char*)blob.c_str();
+        size_t data_size = blob.length();
+
+        if(format != STREAM_FORMAT_RAW &&
+           !ChunkCodec::Decode(data, data_size, chunk_size, mDecodeBuf, &data, &data_size))
+            THROW("Invalid data chunk frame or checksum mismatch");
+
+        // Pass the part of the chunk within the range
+        uint64_t from = std::max(pos, offset);
+        uint64_t to = std::min(pos + data_size, end);
+        if(from < to)
+            keepReading = mReader->OnRead(&hdr, const_cast<unsigned char*>(data) + (from - pos), to - from, DB_STREAM_READ_DATA);
+
+        pos += data_size;
+    }
+
+    return keepReading;
+}
+
+bool MySqlStream::Tail(uint64_t id, uint64_t offset, bool* found)
+{
+    TRY
+    {
+        if(mReader == NULL)
+            THROW("mReader is NULL");
+        if(found == NULL)
+            THROW("bool* found is NULL");
+
+        mFollowStop = false;
+        *found = false;
+
+        StreamHeader hdr;
+        std::string descr;
+        uint64_t pos = offset; // Offset of the data not yet read
+        bool keepReading = true;
+        size_t wait = mOptions.follow_min_wait;
+
+        while(keepReading && !mFollowStop)
+        {
+            uint64_t commits = 0;
+            {
+                std::lock_guard<std::mutex> lock(gCommitMutex);
+                commits = gCommitCount;
+            }
+
+            bool sealed = false;
+            {
+                // Acquire READ lock to block the deletion while reading is in progress
+                std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
+                SqlLockRead lock(stmt, mOptions.lock_mode);
+
+                std::unique_ptr<sql::ResultSet> res(Query(
+                    "SELECT descr, type, size, timestamp, chunksize, format, state FROM " STREAM_TABLE " WHERE id = ?", { id }));
+
+                if(!res->next())
+                {
+                    if(*found)
+                        THROW("The stream was deleted while tailing");
+                    return true;
+                }
+
+                hdr.id = id;
+                hdr.type = (uint8_t)res->getUInt("type");
+                hdr.size = res->getUInt64("size");
+                hdr.timestamp = res->getUInt64("timestamp");
+
+                uint64_t chunk_size = res->getUInt("chunksize");
+                uint8_t format = (uint8_t)res->getUInt("format");
+                sealed = (res->getUInt("state") != STREAM_STATE_OPEN);
+                if(chunk_size == 0)
+                    THROW("Invalid chunk size of the stream");
+
+                if(!*found)
+                {
+                    *found = true;
+                    descr = res->getString("descr");
+                    hdr.descr = descr.c_str();
+
+                    keepReading = mReader->OnRead(&hdr, mBuf.data(), 0, DB_STREAM_READ_BEGIN);
+                }
+
+                if(keepReading && pos < hdr.size)
+                {
+                    keepReading = ReadRangeData(hdr, format, chunk_size, pos, hdr.size);
+                    pos = hdr.size;
+                    wait = mOptions.follow_min_wait;
+                }
+            }
+
+            if(sealed)
+                break; // No more data to come
+
+            // Wait for an append from this process or timeout,
+            // and back off while the stream doesn't grow
+            std::unique_lock<std::mutex> lock(gCommitMutex);
+            gCommitCond.wait_for(lock, std::chrono::milliseconds(wait),
+                [this, commits] { return gCommitCount != commits || mFollowStop; });
+
+            wait = std::min(wait * 2, std::max(mOptions.follow_max_wait, mOptions.follow_min_wait));
+        }
+
+        if(*found)
+            mReader->OnRead(&hdr, mBuf.data(), 0, DB_STREAM_READ_END);
+        return true;
+    }
+    CATCH
+
+    return false;
+}
+
+bool MySqlStream::Read(const char* column,
+                           uint64_t first, bool inclusive_first,
+                           uint64_t last,  bool inclusive_last,
+                           bool* caller_stopped /*=NULL*/, uint64_t* id_read /*=NULL*/)
+{
+    // Note: We are going to lock tables while reading. Let's limit the number
+    // of read streams per query to make sure that Write() is not blocked while
+    // we're reading.
+    size_t limit = STREAMS_PER_QUERY; // Number of streams to read per query
+
+    TRY
+    {
+        if(mReader == NULL)
+            THROW("mReader is NULL");
+        if(column == NULL)
+            THROW("column is NULL");
+
+        // Report the id of the last completely read stream
+        // and if reading was stopped by caller
+        if(caller_stopped != NULL)
+            *caller_stopped = false;
+        if(id_read != NULL)
+            *id_read = 0;
+
+        // Streams can share the timestamp, so the next page by timestamp
+        // starts after the id of the last read stream with that timestamp
+        bool by_id = (strcmp(column, "id") == 0);
+        uint64_t after_id = 0;
+
+        while(true)
+        {
+            // Format SQL query string, the values are passed as parameters
+            char sql[512] = {0};
+            const char* more = (inclusive_first ? ">=" : ">");
             const char* less = (inclusive_last  ? "<=" : "<");
-            
-            if(first > 0 && last > 0)
+            const char* where = " AND";
+            std::vector<uint64_t> params;
+
+            // The open streams are read once sealed, Tail() reads them as they grow
+            sprintf(sql, "SELECT * FROM %s WHERE state = %d", STREAM_TABLE, STREAM_STATE_SEALED);
+
+            if(after_id > 0)
             {
-                sprintf(sql, "SELECT * FROM %s WHERE %s %s %llu AND %s %s %llu", 
-                     STREAM_TABLE, column, more, (long long unsigned int)first, column, less, (long long unsigned int)last);
+                sprintf(sql + strlen(sql), "%s (%s > ? OR (%s = ? AND id > ?))", where, column, column);
+                params.insert(params.end(), { first, first, after_id });
+                where = " AND";
             }
             else if(first > 0)
             {
-                sprintf(sql, "SELECT * FROM %s WHERE %s %s %llu", 
-                     STREAM_TABLE, column, more, (long long unsigned int)first);
+                sprintf(sql + strlen(sql), "%s %s %s ?", where, column, more);
+                params.push_back(first);
+                where = " AND";
             }
-            else if(last > 0)
+
+            if(last > 0)
             {
-                sprintf(sql, "SELECT * FROM %s WHERE %s %s %llu", 
-                     STREAM_TABLE, column, less, (long long unsigned int)last);
+                sprintf(sql + strlen(sql), "%s %s %s ?", where, column, less);
+                params.push_back(last);
             }
+
+            if(by_id)
+                sprintf(sql + strlen(sql), " ORDER BY id ASC");
             else
+                sprintf(sql + strlen(sql), " ORDER BY %s ASC, id ASC", column);
+
+            if(limit > 0)
+                sprintf(sql + strlen(sql), " LIMIT %lu", limit);
+
+            // Acquire READ lock to block the deletion while reading is in progress
+            std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
+            SqlLockRead lock(stmt, mOptions.lock_mode);
+
+            StreamHeader hdr;
+            bool stopped = false;
+
+            if(mOptions.read_mode == DB_STREAM_READ_MODE_BATCH)
+            {
+                // Join the batch of streams with their data, so both headers and
+                // data chunks of all streams come with a single ordered result set.
+                // Every stream has either its own or shared chunks, never both.
+                // Note: The locked tables can't be used by alias under LOCK TABLES.
+                char batch_sql[2048] = {0};
+                sprintf(batch_sql, "SELECT s.id, s.descr, s.type, s.size, s.timestamp, s.chunksize, s.format, "
+                        "IFNULL(" STREAMDATA_TABLE ".data, " CHUNKSTORE_TABLE ".data) AS data "
+                        "FROM (%s) AS s LEFT JOIN " STREAMDATA_TABLE " ON " STREAMDATA_TABLE ".masterid = s.id "
+                        "LEFT JOIN " STREAMCHUNK_TABLE " ON " STREAMCHUNK_TABLE ".masterid = s.id "
+                        "LEFT JOIN " CHUNKSTORE_TABLE " ON " CHUNKSTORE_TABLE ".hash = " STREAMCHUNK_TABLE ".hash "
+                        "ORDER BY s.%s ASC, s.id ASC, " STREAMDATA_TABLE ".%s ASC, " STREAMCHUNK_TABLE ".seq ASC",
+                        sql, column, mClustered ? "seq" : "id");
+
+                size_t count = 0;
+                if(!ReadBatch(batch_sql, params, &hdr, &count, &stopped))
+                    THROW("ReadBatch failed");
+
+                if(stopped)
+                    WriteToLog(LOG_INFO, "ReadBatch stopped by caller");
+                else if(count > 0 && id_read != NULL)
+                    *id_read = hdr.id;
+
+                if(stopped && caller_stopped != NULL)
+                    *caller_stopped = true;
+
+                if(stopped || limit == 0 || count < limit)
+                    break; // Stopped by caller or No more streams left to read
+
+                inclusive_first = false;
+
+                if(by_id)
+                {
+                    first = hdr.id;
+                }
+                else if(strcmp(column, "timestamp") == 0)
+                {
+                    first = hdr.timestamp;
+                    after_id = hdr.id;
+                }
+                else
+                    THROW("Invalid column='" + std::string(column) + "'");
+
+                continue;
+            }
+
+            // Execute query
+            std::unique_ptr<sql::ResultSet> res(Query(sql, params));
+            
+//            std::stringstream msg;
+//            msg << "Query \"" << sql << "\" : " << res->rowsCount() << " rows selected";
+//            WriteToLog(LOG_INFO, msg);
+            
+            while(res->next())
             {
-                sprintf(sql, "SELECT * FROM %s", STREAM_TABLE);
+                //std::cout << "getRow()=" << res->getRow() << std::endl;
+
+                hdr.id = res->getUInt64("id");
+                hdr.type = (uint8_t)res->getUInt("type");
+                hdr.size = res->getUInt64("size");
+                hdr.timestamp = res->getUInt64("timestamp");
+
+                sql::SQLString descr = res->getString("descr");
+                hdr.descr = descr.c_str();
+
+                // Make the whole data chunk fit into the read buffer
+                size_t chunk_size = res->getUInt("chunksize");
+                if(chunk_size > mBuf.size())
+                    mBuf.resize(chunk_size);
+                
+                if(hdr.size == 0)
+                {
+                    std::stringstream msg;
+                    msg << MODULE_NAME << ": Invalid stream (size=0): id=" << hdr.id << ", descr='" << hdr.descr << "'";
+                    WriteToLog(LOG_INFO, msg);
+
+                    mReader->OnRead(&hdr, mBuf.data(), 0, DB_STREAM_READ_BEGIN);
+                    mReader->OnRead(&hdr, mBuf.data(), 0, DB_STREAM_READ_END);
+
+                    if(id_read != NULL)
+                        *id_read = hdr.id;
+                    continue;
+                }
+
+                // Read stream data
+                stopped = false;
+                if(!ReadData(hdr, (uint8_t)res->getUInt("format"), chunk_size, &stopped))
+                {
+                    THROW("ReadData failed");
+                }
+                else if(stopped)
+                {
+                    WriteToLog(LOG_INFO, "ReadData stopped by caller");
+
+                    if(caller_stopped != NULL)
+                        *caller_stopped = true;
+                    break; // Reading was stopped by caller
+                }
+
+                if(id_read != NULL)
+                    *id_read = hdr.id;
             }
             
-            if(limit > 0)
+            if(stopped || limit == 0 || res->rowsCount() < limit)
+                break; // Stopped by caller or No more streams left to read
+            
+            // Reset to keep reading from the next stream (this one is already read)
+            inclusive_first = false;
+
+            if(by_id)
+            {
+                first = hdr.id;
+            }
+            else if(strcmp(column, "timestamp") == 0)
             {
-                sprintf(sql + strlen(sql), " ORDER BY %s ASC LIMIT %lu", column, limit);
+                first = hdr.timestamp;
+                after_id = hdr.id;
             }
             else
+                THROW("Invalid column='" + std::string(column) + "'");
+        }
+        
+        return true;
+    }
+    CATCH
+    
+    //exit(1); // test
+    return false;
+}
+
+DBStreamCursor* MySqlStream::OpenCursorById(uint64_t id_first, bool inclusive_first,
+                                            uint64_t id_last,  bool inclusive_last)
+{
+    return MySqlStreamCursor::Create(this, id_first, inclusive_first, id_last, inclusive_last);
+}
+
+// Fetch the next page of up to STREAMS_PER_QUERY stream headers for
+// MySqlStreamCursor. The descr, data format and chunk size of the
+// headers are returned in descrs, formats and chunk_sizes.
+bool MySqlStream::ReadHeaders(uint64_t first, bool inclusive_first,
+                              uint64_t last,  bool inclusive_last,
+                              std::deque<StreamHeader>* hdrs, std::deque<std::string>* descrs,
+                              std::deque<uint8_t>* formats, std::deque<uint64_t>* chunk_sizes, bool* all_read)
+{
+    TRY
+    {
+        if(hdrs == NULL || descrs == NULL || formats == NULL || chunk_sizes == NULL || all_read == NULL)
+            THROW("hdrs, descrs, formats, chunk_sizes or all_read is NULL");
+
+        // Format SQL query string
+        char sql[256] = {0};
+        const char* more = (inclusive_first ? ">=" : ">");
+        const char* less = (inclusive_last  ? "<=" : "<");
+
+        std::vector<uint64_t> params = { first };
+
+        // The open streams are skipped like by Read()
+        sprintf(sql, "SELECT id, descr, type, size, timestamp, chunksize, format FROM " STREAM_TABLE " WHERE state = %d AND id %s ?",
+                STREAM_STATE_SEALED, more);
+        if(last > 0)
+        {
+            sprintf(sql + strlen(sql), " AND id %s ?", less);
+            params.push_back(last);
+        }
+        sprintf(sql + strlen(sql), " ORDER BY id ASC LIMIT %lu", STREAMS_PER_QUERY);
+
+        // Acquire READ lock to block the deletion while reading is in progress
+        std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
+        SqlLockRead lock(stmt, mOptions.lock_mode);
+
+        // Execute query
+        std::unique_ptr<sql::ResultSet> res(Query(sql, params));
+        *all_read = (res->rowsCount() < STREAMS_PER_QUERY);
+
+        while(res->next())
+        {
+            StreamHeader hdr;
+            hdr.id = res->getUInt64("id");
+            hdr.descr = NULL;
+            hdr.type = (uint8_t)res->getUInt("type");
+            hdr.size = res->getUInt64("size");
+            hdr.timestamp = res->getUInt64("timestamp");
+
+            hdrs->push_back(hdr);
+            descrs->push_back(res->getString("descr"));
+            formats->push_back((uint8_t)res->getUInt("format"));
+            chunk_sizes->push_back(res->getUInt("chunksize"));
+        }
+
+        return true;
+    }
+    CATCH
+
+    return false;
+}
+
+// Fetch the data chunks following chunk_id of the given stream for
+// MySqlStreamCursor, as many as fit a write batch (see InitWriteBatch()),
+// and advance chunk_id to the last one. The chunks are returned decoded,
+// and there are none at the end of the stream.
+bool MySqlStream::ReadChunks(uint64_t master_id, uint8_t format, uint64_t chunk_size,
+                             uint64_t* chunk_id, std::deque<std::string>* chunks)
+{
+    TRY
+    {
+        if(chunk_id == NULL || chunks == NULL)
+            THROW("chunk_id or chunks is NULL");
+
+        // Acquire READ lock to block the deletion while reading is in progress
+        std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
+        SqlLockRead lock(stmt, mOptions.lock_mode);
+
+        // Execute query, the chunk is identified by its seq or id (see mClustered)
+        std::string sql =
+            "SELECT id, data FROM " STREAMDATA_TABLE " WHERE masterid = ? AND id > ? ORDER BY id";
+        if(format == STREAM_FORMAT_DEDUP)
+            sql = "SELECT " STREAMCHUNK_TABLE ".seq AS id, " CHUNKSTORE_TABLE ".data FROM " STREAMCHUNK_TABLE
+                  " JOIN " CHUNKSTORE_TABLE " ON " CHUNKSTORE_TABLE ".hash = " STREAMCHUNK_TABLE ".hash"
+                  " WHERE " STREAMCHUNK_TABLE ".masterid = ? AND " STREAMCHUNK_TABLE ".seq > ?"
+                  " ORDER BY " STREAMCHUNK_TABLE ".seq";
+        else if(mClustered)
+            sql = "SELECT seq AS id, data FROM " STREAMDATA_TABLE " WHERE masterid = ? AND seq > ? ORDER BY seq";
+
+        sql += " LIMIT " + std::to_string(mBatchRows);
+
+        std::unique_ptr<sql::ResultSet> res(Query(sql, { master_id, *chunk_id }));
+
+        while(res->next())
+        {
+            *chunk_id = res->getUInt64("id");
+            chunks->push_back(res->getString("data"));
+
+            if(format != STREAM_FORMAT_RAW)
+            {
+                std::string& data = chunks->back();
+                const unsigned char* chunk = NULL;
+                size_t size = 0;
+                if(!ChunkCodec::Decode((const unsigned char*)data.data(), data.size(), chunk_size, mDecodeBuf, &chunk, &size))
+                    THROW("Invalid data chunk frame or checksum mismatch");
+
+                data.assign((const char*)chunk, size);
+            }
+        }
+
+        return true;
+    }
+    CATCH
+
+    return false;
+}
+
+bool MySqlStream::Follow(uint64_t id_first, bool inclusive_first)
+{
+    TRY
+    {
+        if(mReader == NULL)
+            THROW("mReader is NULL");
+
+        mFollowStop = false;
+
+        uint64_t next = (inclusive_first ? id_first : id_first + 1); // Id of the next stream to read
+        size_t wait = mOptions.follow_min_wait;
+
+        // The ids are allocated when the stream is inserted, and committed
+        // later, group committed streams up to group_commit_latency later.
+        // The ids up to the MAX(id) probed gap_wait ago were allocated that
+        // long ago at least, so the ones still missing are given up on as
+        // rolled back or deleted.
+        const std::chrono::milliseconds gap_wait(std::max(mOptions.follow_gap_wait, mOptions.group_commit_latency));
+        std::deque<std::pair<std::chrono::steady_clock::time_point, uint64_t>> probes;
+
+        while(!mFollowStop)
+        {
+            uint64_t commits = 0;
             {
-                sprintf(sql + strlen(sql), " ORDER BY %s ASC", column);
+                std::lock_guard<std::mutex> lock(gCommitMutex);
+                commits = gCommitCount;
             }
-            
-            // Acquire READ lock to block the deletion while reading is in progress
-            std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
-            SqlLockRead lock(stmt);
 
-            // Execute query
-            std::unique_ptr<sql::ResultSet> res(stmt->executeQuery(sql));
-            
-//            std::stringstream msg;
-//            msg << "Query \"" << sql << "\" : " << res->rowsCount() << " rows selected";
-//            WriteToLog(LOG_INFO, msg);
-            
-            StreamHeader hdr;
-            bool stopped = false;
-            
-            while(res->next())
+            uint64_t id_end = next; // Read the streams from next up to id_end
             {
-                //std::cout << "getRow()=" << res->getRow() << std::endl;
+                // Probe in a transaction of its own (see SqlLock), so the new
+                // streams are seen even if the connection was left in one
+                std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
+                SqlLockRead lock(stmt, mOptions.lock_mode);
 
-                hdr.id = res->getUInt64("id");
-                hdr.type = (uint8_t)res->getUInt("type");
-                hdr.size = res->getUInt64("size");
-                hdr.timestamp = res->getUInt64("timestamp");
+                // Probe for new streams first, MAX(id) is resolved
+                // from the primary key alone and is cheap to run often
+                std::unique_ptr<sql::ResultSet> res(Query("SELECT IFNULL(MAX(id), 0) FROM " STREAM_TABLE, {}));
+                if(!res->next())
+                    THROW("ResultSet::next failed");
 
-                sql::SQLString descr = res->getString("descr");
-                hdr.descr = descr.c_str();
-                
-                if(hdr.size == 0)
-                {
-                    std::stringstream msg;
-                    msg << MODULE_NAME << ": Invalid stream (size=0): id=" << hdr.id << ", descr='" << hdr.descr << "'";
-                    WriteToLog(LOG_INFO, msg);
+                uint64_t id_last = res->getUInt64(1);
+                res.reset();
 
-                    mReader->OnRead(&hdr, mBuf, 0, DB_STREAM_READ_BEGIN);
-                    mReader->OnRead(&hdr, mBuf, 0, DB_STREAM_READ_END);
-                    continue;
-                }
+                auto now = std::chrono::steady_clock::now();
+                probes.emplace_back(now, id_last);
+                while(probes.size() > 1 && now - probes[1].first >= gap_wait)
+                    probes.pop_front();
 
-                // Read stream data
-                stopped = false;
-                if(!ReadData(hdr, &stopped))
-                {
-                    THROW("ReadData failed");
-                }
-                else if(stopped)
+                uint64_t id_settled = (now - probes.front().first >= gap_wait ? probes.front().second : 0);
+
+                if(id_last >= next)
                 {
-                    WriteToLog(LOG_INFO, "ReadData stopped by caller");
-                	break; // Reading was stopped by caller
+                    // Read as far as the streams follow each other without a gap
+                    // that may still be filled. Stop at the first stream still
+                    // open too, the ones after it wait until it is sealed.
+                    res.reset(Query("SELECT id, state FROM " STREAM_TABLE " WHERE id >= ? ORDER BY id LIMIT " +
+                                    std::to_string(STREAMS_PER_QUERY), { next }));
+
+                    while(res->next())
+                    {
+                        uint64_t id = res->getUInt64("id");
+                        if(id > id_end && id - 1 > id_settled)
+                            break;
+                        if(res->getUInt("state") == STREAM_STATE_OPEN)
+                            break;
+
+                        id_end = id + 1;
+                    }
                 }
             }
-            
-            if(stopped || limit == 0 || res->rowsCount() < limit)
-                break; // Stopped by caller or No more streams left to read
-            
-            // Reset to keep reading from the next stream (this one is already read)
-            inclusive_first = false;
 
-            if(strcmp(column, "id") == 0)
-                first = hdr.id;
-            else if(strcmp(column, "timestamp") == 0)
-                first = hdr.timestamp;
-            else
-                THROW("Invalid column='" + std::string(column) + "'");
+            if(id_end > next)
+            {
+                bool stopped = false;
+
+                if(!Read("id", next, true, id_end, false, &stopped))
+                    THROW("Read failed");
+
+                if(stopped)
+                    break; // Reading was stopped by caller
+
+                next = id_end;
+                wait = mOptions.follow_min_wait;
+                continue;
+            }
+
+            // Nothing new yet. Wait for a commit from this process
+            // or timeout, and back off while there are no new streams.
+            std::unique_lock<std::mutex> lock(gCommitMutex);
+            gCommitCond.wait_for(lock, std::chrono::milliseconds(wait),
+                [this, commits] { return gCommitCount != commits || mFollowStop; });
+
+            wait = std::min(wait * 2, std::max(mOptions.follow_max_wait, mOptions.follow_min_wait));
         }
-        
+
         return true;
     }
     CATCH
-    
-    //exit(1); // test
+
     return false;
 }
 
+void MySqlStream::StopFollow()
+{
+    {
+        std::lock_guard<std::mutex> lock(gCommitMutex);
+        mFollowStop = true;
+    }
+
+    gCommitCond.notify_all();
+}
+
 bool MySqlStream::DeleteById(uint64_t id_first, bool inclusive_first,
                              uint64_t id_last,  bool inclusive_last)
 {
     return Delete("id", id_first, inclusive_first, id_last, inclusive_last);
 }
 
+bool MySqlStream::DeleteByTimestamp(uint64_t timestamp_first, bool inclusive_first,
+                                    uint64_t timestamp_last,  bool inclusive_last)
+{
+    return Delete("timestamp", timestamp_first, inclusive_first, timestamp_last, inclusive_last);
+}
+
 bool MySqlStream::DeleteAll()
 {
-    return Delete("id", 0, true, 0, true);
+    return Truncate(false);
+}
+
+bool MySqlStream::DeleteAll(bool reset_id)
+{
+    return Truncate(reset_id);
 }
 
 bool MySqlStream::Delete(const char* column,
@@ -601,61 +2460,205 @@ bool MySqlStream::Delete(const char* column,
         mCon->setAutoCommit(true);
 
         // Format SQL query string
-        char sql[256] = {0};
+        // The partitioned tables have no foreign key to cascade the deletion,
+        // so delete the stream data along with the streams
+        char where[512] = {0};
         const char* more = (inclusive_first ? ">=" : ">");
         const char* less = (inclusive_last  ? "<=" : "<");
 
         if(first > 0 && last > 0)
         {
-            sprintf(sql, "DELETE FROM %s WHERE %s %s %llu AND id %s %llu", 
-                STREAM_TABLE, column, more, (long long unsigned int)first, less, (long long unsigned int)last);
+            sprintf(where, STREAM_TABLE ".%s %s %llu AND " STREAM_TABLE ".%s %s %llu", 
+                column, more, (long long unsigned int)first, column, less, (long long unsigned int)last);
         }
         else if(first > 0)
         {
-            sprintf(sql, "DELETE FROM %s WHERE %s %s %llu", 
-                STREAM_TABLE, column, more, (long long unsigned int)first);
+            sprintf(where, STREAM_TABLE ".%s %s %llu", 
+                column, more, (long long unsigned int)first);
         }
         else if(last > 0)
         {
-            sprintf(sql, "DELETE FROM %s WHERE %s %s %llu", 
-                STREAM_TABLE, column, less, (long long unsigned int)last);
+            sprintf(where, STREAM_TABLE ".%s %s %llu", 
+                column, less, (long long unsigned int)last);
         }
         else
         {
-            sprintf(sql, "DELETE FROM %s", STREAM_TABLE);
-
-            //
-            // TODO: Consider using TRUNCATE TABLE since it is faster then DELETE FROM
-            //
-            // NOTE: There is a bug "TRUNCATE TABLE was not allowed under LOCK TABLES"
-            // which is still present in the current DB we have installed, but should
-            // be fixed in the later version:
-            // http://bugs.mysql.com/bug.php?id=20667
-            //
-            // TODO: Try to upgrade MySql and verify if TRUNCATE TABLE worked on locked table
-            //
+            // Delete all streams
+            if(!Truncate(reset_id))
+                THROW("Truncate failed");
+            return true;
         }
 
         // Acquire WRITE lock to block the reading while deletion is in progress
         std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
-        SqlLockWrite lock(stmt);
+        SqlLockWrite lock(stmt, mOptions.lock_mode);
+
+        // Release the shared chunks along with the deletion
+        SqlTransaction tran(mCon.get());
+        ReleaseChunks(stmt.get(), where);
 
         // Execute query
-        stmt->execute(sql);
+        stmt->execute(SqlDeleteFrom(mPartitioned) + std::string(" WHERE ") + where);
+        tran.Commit();
 
 //        std::stringstream msg;
 //        msg << std::boolalpha;
 //        msg << MODULE_NAME ": Query \"" << sql << "\" : " << stmt->getUpdateCount() << " rows deleted";
 //        WriteToLog(LOG_INFO, msg);
 
-        if(reset_id && first == 0 && last == 0)
+        return true;
+    }
+    CATCH
+
+    return false;
+}
+
+bool MySqlStream::PurgeById(uint64_t id_first, bool inclusive_first,
+                            uint64_t id_last,  bool inclusive_last,
+                            DBStreamPurgeProgress* progress)
+{
+    return Purge("id", id_first, inclusive_first, id_last, inclusive_last, progress);
+}
+
+bool MySqlStream::PurgeByTimestamp(uint64_t timestamp_first, bool inclusive_first,
+                                   uint64_t timestamp_last,  bool inclusive_last,
+                                   DBStreamPurgeProgress* progress)
+{
+    return Purge("timestamp", timestamp_first, inclusive_first, timestamp_last, inclusive_last, progress);
+}
+
+// Delete the streams in small batches, each one in its own transaction and
+// under its own WRITE lock, so the writers and readers get their turn between
+// the batches.
+bool MySqlStream::Purge(const char* column,
+                        uint64_t first, bool inclusive_first,
+                        uint64_t last,  bool inclusive_last,
+                        DBStreamPurgeProgress* progress)
+{
+    TRY
+    {
+        if(column == NULL)
+            THROW("column is NULL");
+
+        // Enable autocommit
+        mCon->setAutoCommit(true);
+
+        size_t batch_size = (mOptions.purge_batch_size > 0 ? mOptions.purge_batch_size : 1);
+        uint64_t deleted = 0;
+
+        // Format SQL query string to select the next batch
+        // Note: The deleted streams are gone, so every batch starts from the range beginning
+        char sql[512] = {0};
+        const char* more = (inclusive_first ? ">=" : ">");
+        const char* less = (inclusive_last  ? "<=" : "<");
+
+        sprintf(sql, "SELECT id FROM " STREAM_TABLE " WHERE %s %s %llu",
+            column, more, (long long unsigned int)first);
+        if(last > 0)
+            sprintf(sql + strlen(sql), " AND %s %s %llu", column, less, (long long unsigned int)last);
+        sprintf(sql + strlen(sql), " ORDER BY %s ASC, id ASC LIMIT %lu", column, batch_size);
+
+        std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
+
+        while(true)
+        {
+            auto start = std::chrono::steady_clock::now();
+
+            std::vector<uint64_t> ids;
+            {
+                std::unique_ptr<sql::ResultSet> res(stmt->executeQuery(sql));
+                while(res->next())
+                    ids.push_back(res->getUInt64("id"));
+            }
+
+            if(ids.empty())
+                break; // Nothing left to delete
+
+            std::stringstream where;
+            where << STREAM_TABLE ".id IN (";
+            for(size_t i = 0; i < ids.size(); i++)
+                where << (i > 0 ? "," : "") << ids[i];
+            where << ")";
+
+            {
+                // Acquire WRITE lock to block the reading while deletion is in progress
+                SqlLockWrite lock(stmt, mOptions.lock_mode);
+
+                // Release the shared chunks along with the deletion
+                SqlTransaction tran(mCon.get());
+                ReleaseChunks(stmt.get(), where.str());
+
+                stmt->execute(SqlDeleteFrom(mPartitioned) + std::string(" WHERE ") + where.str());
+                tran.Commit();
+            }
+
+            deleted += ids.size();
+
+            if(progress != NULL && !progress->OnPurge(deleted, ids.back()))
+                break; // Stopped by caller
+
+            if(ids.size() < batch_size)
+                break; // No more streams left to delete
+
+            // Keep the deletion rate, and let other threads run anyway
+            if(mOptions.purge_rate > 0)
+            {
+                auto batch_time = std::chrono::microseconds(ids.size() * 1000000 / mOptions.purge_rate);
+                std::this_thread::sleep_until(start + batch_time);
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        return true;
+    }
+    CATCH
+
+    return false;
+}
+
+// Empty all tables with TRUNCATE TABLE, which recreates them instead of
+// deleting the rows one by one. The ids continue after the last stream
+// unless reset_id, so the readers following the ids don't miss new streams.
+bool MySqlStream::Truncate(bool reset_id)
+{
+    TRY
+    {
+        // Enable autocommit
+        mCon->setAutoCommit(true);
+
+        std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
+
+        // The stream table can't be truncated while the data table refers to it
+        SqlNoForeignKeyChecks fk(stmt);
+
+        // Acquire WRITE lock even in the snapshot mode to make sure no stream
+        // is written between truncating the two tables
+        SqlLockWrite lock(stmt, DB_STREAM_LOCK_TABLES);
+
+        uint64_t id_next = 1;
+        if(!reset_id)
+        {
+            std::unique_ptr<sql::ResultSet> res(stmt->executeQuery("SELECT IFNULL(MAX(id), 0) + 1 FROM " STREAM_TABLE));
+            if(!res->next())
+                THROW("ResultSet::next failed");
+
+            id_next = res->getUInt64(1);
+        }
+
+        // Note: TRUNCATE TABLE resets auto_increment of the table
+        stmt->execute("TRUNCATE TABLE " STREAMDATA_TABLE);
+        stmt->execute("TRUNCATE TABLE " STREAMCHUNK_TABLE);
+        stmt->execute("TRUNCATE TABLE " CHUNKSTORE_TABLE);
+        stmt->execute("TRUNCATE TABLE " STREAM_TABLE);
+
+        if(id_next > 1)
         {
-            // Reset auto_increment since tables are empty now
-            // Note: batch processing in not yet available in C++ connector,
-            // hence we have to execute it for every table
-            //
-            stmt->execute("ALTER table " STREAM_TABLE " AUTO_INCREMENT=1");
-            stmt->execute("ALTER table " STREAMDATA_TABLE " AUTO_INCREMENT=1");
+            char sql[256] = {0};
+            sprintf(sql, "ALTER TABLE " STREAM_TABLE " AUTO_INCREMENT=%llu", (long long unsigned int)id_next);
+            stmt->execute(sql);
         }
 
         return true;
@@ -690,10 +2693,10 @@ bool MySqlStream::Get(StreamHeader* hdr, const char* order)
 
         // Acquire READ lock to block the deletion while reading is in progress
         std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
-        SqlLockRead lock(stmt);
+        SqlLockRead lock(stmt, mOptions.lock_mode);
 
         // Execute query
-        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery(sql));
+        std::unique_ptr<sql::ResultSet> res(Query(sql, {}));
 
         if(res->rowsCount() == 0)
         {
@@ -708,11 +2711,10 @@ bool MySqlStream::Get(StreamHeader* hdr, const char* order)
             if(!res->next())
                 THROW("ResultSet::next failed");
 
-            sql::SQLString descr = res->getString("descr");
-            strcpy((char*)mBuf, descr.c_str());
+            mDescr = res->getString("descr");
 
             hdr->id = res->getUInt64("id");
-            hdr->descr = (const char*)mBuf;
+            hdr->descr = mDescr.c_str();
             hdr->size = res->getUInt64("size");
             hdr->timestamp = res->getUInt64("timestamp");
         }
@@ -729,6 +2731,49 @@ bool MySqlStream::LookupById(uint64_t id, bool* found)
     return Lookup("id", id, found);
 }
 
+bool MySqlStream::LookupByTimestamp(uint64_t timestamp, bool* found)
+{
+    return Lookup("timestamp", timestamp, found);
+}
+
+// Get the min and max timestamp and the count of the sealed streams of the
+// timestamp range (without upper limit if timestamp_last is 0). The count is 0
+// if there are no streams in the range.
+bool MySqlStream::GetTimestampRange(uint64_t timestamp_first, bool inclusive_first,
+                                    uint64_t timestamp_last,  bool inclusive_last,
+                                    uint64_t* timestamp_min, uint64_t* timestamp_max, uint64_t* count)
+{
+    TRY
+    {
+        if(timestamp_min == NULL || timestamp_max == NULL || count == NULL)
+            THROW("timestamp_min, timestamp_max or count is NULL");
+
+        char sql[256] = {0};
+        std::vector<uint64_t> params = { timestamp_first };
+
+        // The open streams are skipped like by Read()
+        sprintf(sql, "SELECT IFNULL(MIN(timestamp), 0), IFNULL(MAX(timestamp), 0), COUNT(*) FROM " STREAM_TABLE
+                " WHERE state = %d AND timestamp %s ?", STREAM_STATE_SEALED, inclusive_first ? ">=" : ">");
+        if(timestamp_last > 0)
+        {
+            sprintf(sql + strlen(sql), " AND timestamp %s ?", inclusive_last ? "<=" : "<");
+            params.push_back(timestamp_last);
+        }
+
+        std::unique_ptr<sql::ResultSet> res(Query(sql, params));
+        if(!res->next())
+            THROW("ResultSet::next failed");
+
+        *timestamp_min = res->getUInt64(1);
+        *timestamp_max = res->getUInt64(2);
+        *count = res->getUInt64(3);
+        return true;
+    }
+    CATCH
+
+    return false;
+}
+
 // Lookup by value (id, timestamp, etc.)
 bool MySqlStream::Lookup(const char* column, uint64_t val, bool* found)
 {
@@ -743,15 +2788,15 @@ bool MySqlStream::Lookup(const char* column, uint64_t val, bool* found)
         // Use SELECT 1 to to prevent the checking of unnecessary fields
         // Use LIMIT 1 to prevent the checking of unnecessary rows
         char sql[256] = {0};
-        sprintf(sql, "SELECT 1 FROM %s WHERE %s = %llu LIMIT 1", 
-            STREAM_TABLE, column, (long long unsigned int)val);
+        sprintf(sql, "SELECT 1 FROM %s WHERE %s = ? LIMIT 1", 
+            STREAM_TABLE, column);
 
         // Acquire READ lock to block the deletion while reading is in progress
         std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
-        SqlLockRead lock(stmt);
+        SqlLockRead lock(stmt, mOptions.lock_mode);
 
         // Execute query
-        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery(sql));
+        std::unique_ptr<sql::ResultSet> res(Query(sql, { val }));
 
         *found = (res->rowsCount() > 0);
         return true;
@@ -761,56 +2806,73 @@ bool MySqlStream::Lookup(const char* column, uint64_t val, bool* found)
     return false;
 }
 
-bool MySqlStream::ReadData(const StreamHeader& hdr, bool* stopped)
+bool MySqlStream::ReadData(const StreamHeader& hdr, uint8_t format, uint64_t chunk_size, bool* stopped)
 {
     TRY
     {
         // Don't need to call acquire READ lock as it it already acquired by Read()
 
-        std::unique_ptr<sql::Statement> stmt(mCon->createStatement());
-        char sql[256] = {0};
-
-        // Get all data records for the given master id
         uint64_t masterid = hdr.id;
-        sprintf(sql, "SELECT id FROM " STREAMDATA_TABLE " WHERE masterid = %llu order by id", 
-            (long long unsigned int)masterid);
-        std::unique_ptr<sql::ResultSet> res(stmt->executeQuery(sql));
 
-        bool keepReading = mReader->OnRead(&hdr, mBuf, 0, DB_STREAM_READ_BEGIN);
+        // The stream has either its own data chunks, keyed by seq or id (see
+        // mClustered), or the shared chunks of the deduplicated stream
+        const char* data_sql = "SELECT data FROM " STREAMDATA_TABLE " WHERE masterid = ? ORDER BY id";
+        const char* ids_sql = "SELECT id FROM " STREAMDATA_TABLE " WHERE masterid = ? order by id";
+        const char* chunk_sql = "SELECT data FROM " STREAMDATA_TABLE " WHERE masterid = ? AND id = ?";
 
-        while(keepReading && res->next())
+        if(format == STREAM_FORMAT_DEDUP)
         {
-            // Get the data itself
-            uint64_t id = res->getUInt64("id");
-            sprintf(sql, "SELECT data FROM " STREAMDATA_TABLE " WHERE id=%llu", (unsigned long long int)id);
-            std::unique_ptr<sql::ResultSet> data_res(stmt->executeQuery(sql));
-
-            //if(data_res->rowsCount() == 0)
-            //    THROW(__func__ ": ResultSet::rowsCount returned 0");
-
-            if(!data_res->next())
-                THROW("ResultSet::next failed");
+            data_sql = "SELECT " CHUNKSTORE_TABLE ".data FROM " STREAMCHUNK_TABLE
+                       " JOIN " CHUNKSTORE_TABLE " ON " CHUNKSTORE_TABLE ".hash = " STREAMCHUNK_TABLE ".hash"
+                       " WHERE " STREAMCHUNK_TABLE ".masterid = ? ORDER BY " STREAMCHUNK_TABLE ".seq";
+            ids_sql = "SELECT seq AS id FROM " STREAMCHUNK_TABLE " WHERE masterid = ? order by seq";
+            chunk_sql = "SELECT " CHUNKSTORE_TABLE ".data FROM " STREAMCHUNK_TABLE
+                        " JOIN " CHUNKSTORE_TABLE " ON " CHUNKSTORE_TABLE ".hash = " STREAMCHUNK_TABLE ".hash"
+                        " WHERE " STREAMCHUNK_TABLE ".masterid = ? AND " STREAMCHUNK_TABLE ".seq = ?";
+        }
+        else if(mClustered)
+        {
+            data_sql = "SELECT data FROM " STREAMDATA_TABLE " WHERE masterid = ? ORDER BY seq";
+            ids_sql = "SELECT seq AS id FROM " STREAMDATA_TABLE " WHERE masterid = ? order by seq";
+            chunk_sql = "SELECT data FROM " STREAMDATA_TABLE " WHERE masterid = ? AND seq = ?";
+        }
 
-            std::istream* blob = data_res->getBlob("data");
-            if(blob == NULL)
-                THROW("ResultSet::getBlob failed");
+        bool keepReading = mReader->OnRead(&hdr, mBuf.data(), 0, DB_STREAM_READ_BEGIN);
 
-            size_t size_total = 0;
+        if(mOptions.read_mode == DB_STREAM_READ_MODE_STREAM ||
+           mOptions.read_mode == DB_STREAM_READ_MODE_BATCH)
+        {
+            // Get all data records for the given master id with a single query.
+            // Unbuffered (forward only) result set fetches the rows from the server
+            // one by one as we go instead of storing the whole result first.
+            std::unique_ptr<sql::ResultSet> res(keepReading ?
+                Query(data_sql, { masterid }, mOptions.read_unbuffered) : NULL);
+
+            while(keepReading && res->next())
+                keepReading = ReadBlob(hdr, format, chunk_size, *res);
+        }
+        else
+        {
+            // Get all data record ids for the given master id
+            std::unique_ptr<sql::ResultSet> res(Query(ids_sql, { masterid }));
 
-            while(keepReading && *blob)
+            while(keepReading && res->next())
             {
-                blob->read((char*)mBuf, sizeof(mBuf));
-                size_t size_read = blob->gcount();
-                size_total += size_read;
+                // Get the data itself
+                uint64_t id = res->getUInt64("id");
+                std::unique_ptr<sql::ResultSet> data_res(Query(chunk_sql, { masterid, id }));
 
-                //std::cout << "data: master_id=" << master_id << ", id=" << id << ", size=" << size_total << std::endl;
+                //if(data_res->rowsCount() == 0)
+                //    THROW(__func__ ": ResultSet::rowsCount returned 0");
 
-                if(size_read > 0)
-                	keepReading = mReader->OnRead(&hdr, mBuf, size_read, DB_STREAM_READ_DATA);
+                if(!data_res->next())
+                    THROW("ResultSet::next failed");
+
+                keepReading = ReadBlob(hdr, format, chunk_size, *data_res);
             }
         }
 
-        mReader->OnRead(&hdr, mBuf, 0, DB_STREAM_READ_END);
+        mReader->OnRead(&hdr, mBuf.data(), 0, DB_STREAM_READ_END);
 
         if(stopped != NULL)
         	*stopped = !keepReading;
@@ -821,3 +2883,135 @@ bool MySqlStream::ReadData(const StreamHeader& hdr, bool* stopped)
     return false;
 }
 
+// Read the streams of a single batch query (see Read()), where every row
+// carries the stream header along with one of its data chunks (or NULL data
+// for the stream without data).
+bool MySqlStream::ReadBatch(const char* sql, const std::vector<uint64_t>& params,
+                            StreamHeader* hdr, size_t* count, bool* stopped)
+{
+    TRY
+    {
+        // Don't need to call acquire READ lock as it it already acquired by Read()
+
+        // Note: The unbuffered result set doesn't support rowsCount(),
+        // so count the streams while reading them
+        std::unique_ptr<sql::ResultSet> res(Query(sql, params, mOptions.read_unbuffered));
+
+        sql::SQLString descr;
+        uint8_t format = STREAM_FORMAT_RAW;
+        uint64_t chunk_size = 0;
+        bool keepReading = true;
+        bool inStream = false;
+        *count = 0;
+
+        while(res->next())
+        {
+            uint64_t id = res->getUInt64("id");
+
+            if(!inStream || id != hdr->id)
+            {
+                if(inStream)
+                {
+                    inStream = false;
+                    mReader->OnRead(hdr, mBuf.data(), 0, DB_STREAM_READ_END);
+                    if(!keepReading)
+                        break; // Reading was stopped by caller
+                }
+
+                // The next stream begins
+                hdr->id = id;
+                hdr->type = (uint8_t)res->getUInt("type");
+                hdr->size = res->getUInt64("size");
+                hdr->timestamp = res->getUInt64("timestamp");
+
+                descr = res->getString("descr");
+                hdr->descr = descr.c_str();
+                format = (uint8_t)res->getUInt("format");
+
+                chunk_size = res->getUInt("chunksize");
+                if(chunk_size > mBuf.size())
+                    mBuf.resize(chunk_size);
+
+                (*count)++;
+                inStream = true;
+
+                if(hdr->size == 0)
+                {
+                    std::stringstream msg;
+                    msg << MODULE_NAME << ": Invalid stream (size=0): id=" << hdr->id << ", descr='" << hdr->descr << "'";
+                    WriteToLog(LOG_INFO, msg);
+
+                    mReader->OnRead(hdr, mBuf.data(), 0, DB_STREAM_READ_BEGIN);
+                    continue;
+                }
+
+                keepReading = mReader->OnRead(hdr, mBuf.data(), 0, DB_STREAM_READ_BEGIN);
+            }
+
+            if(keepReading && !res->isNull("data"))
+                keepReading = ReadBlob(*hdr, format, chunk_size, *res);
+        }
+
+        if(inStream)
+            mReader->OnRead(hdr, mBuf.data(), 0, DB_STREAM_READ_END);
+
+        *stopped = !keepReading;
+        return true;
+    }
+    CATCH
+
+    return false;
+}
+
+// Pass the "data" column of the current row to the reader. The framed
+// chunk (see chunkcodec.h) is decoded and passed in one piece.
+// Returns false if reading was stopped by caller.
+// Note: Throws on failure, so must be called from within TRY block.
+bool MySqlStream::ReadBlob(const StreamHeader& hdr, uint8_t format, uint64_t chunk_size, sql::ResultSet& res)
+{
+    if(format != STREAM_FORMAT_RAW)
+    {
+        sql::SQLString frame = res.getString("data");
+
+        const unsigned char* data = NULL;
+        size_t size = 0;
+        if(!ChunkCodec::Decode((const unsigned char*)frame.c_str(), frame.length(), chunk_size, mDecodeBuf, &data, &size))
+            THROW("Invalid data chunk frame or checksum mismatch");
+
+        if(size == 0)
+            return true;
+
+        return mReader->OnRead(&hdr, const_cast<unsigned char*>(data), size, DB_STREAM_READ_DATA);
+    }
+
+    if(mOptions.read_direct)
+    {
+        // Pass the chunk in one piece. getString() copies it out of the fetched
+        // row (the connector has no access to the row buffer itself), and
+        // getBlob() would copy it twice more (into istringstream and into mBuf).
+        sql::SQLString blob = res.getString("data");
+        std::string* data = blob.operator->();
+
+        if(data->empty())
+            return true;
+
+        return mReader->OnRead(&hdr, (unsigned char*)&(*data)[0], data->size(), DB_STREAM_READ_DATA);
+    }
+
+    std::unique_ptr<std::istream> blob(res.getBlob("data"));
+    if(blob.get() == NULL)
+        THROW("ResultSet::getBlob failed");
+
+    bool keepReading = true;
+
+    while(keepReading && *blob)
+    {
+        blob->read((char*)mBuf.data(), mBuf.size());
+        size_t size_read = blob->gcount();
+
+        if(size_read > 0)
+            keepReading = mReader->OnRead(&hdr, mBuf.data(), size_read, DB_STREAM_READ_DATA);
+    }
+
+    return keepReading;
+}
@@ -7,7 +7,16 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <sstream>
+#include <atomic>
 #include <cppconn/connection.h>
+#include <cppconn/resultset.h>
+#include <cppconn/prepared_statement.h>
 #include "dbstream.h"
 
 //
@@ -19,7 +28,7 @@ private:
     // Private constructor/destructor to force using Create/Destroy methods
     MySqlStream(const char* host, const char* user, const char* passwd,
                     const char* database, DBStreamReader* reader,
-                    DBStreamLogger* logger);
+                    DBStreamLogger* logger, const DBStreamOptions* options);
     virtual ~MySqlStream() = default; 
     MySqlStream& operator=(const MySqlStream&) = delete; // Don't allow class copy
 
@@ -27,20 +36,54 @@ private:
 private:
     DBStreamReader* mReader = NULL;
     DBStreamLogger* mLogger = NULL;
+    DBStreamOptions mOptions;
     std::unique_ptr<sql::Connection> mCon;
 
-    // The maximum length of the BLOB column is 65535 (2^16-1) bytes
-    unsigned char mBuf[65535];
+    // Statements of the fixed shapes prepared on the connection by their SQL,
+    // and the statement to run the unbuffered queries (see Query())
+    std::map<std::string, std::unique_ptr<sql::PreparedStatement>> mStatements;
+    std::unique_ptr<sql::Statement> mQueryStmt;
+
+    // Read buffer to pass the stream data chunks to the reader
+    std::vector<unsigned char> mBuf;
+    std::string mDescr;
+
+    // Set by StopFollow() to stop Follow() from another thread
+    std::atomic<bool> mFollowStop{false};
+
+    // The tables are partitioned by stream id (see DBStreamOptions::partition_size)
+    bool mPartitioned = false;
+
+    // The data chunks are keyed by (masterid, seq) rather than by their own
+    // id (the tables created before, see MigrateLayout())
+    bool mClustered = false;
+
+    // Write() inserts up to mBatchRows data chunks per INSERT statement
+    size_t mBatchRows = 1;
+    std::vector<unsigned char> mBatchBuf;
+
+    // Framed (see chunkcodec.h) data chunks of the INSERT statement being
+    // written, and the chunk being decoded while reading
+    std::vector<unsigned char> mFrameBuf;
+    std::vector<unsigned char> mDecodeBuf;
 
     // Methods
 public:
     static MySqlStream* Create(const char* host, const char* user, const char* passwd,
                                    const char* database, DBStreamReader* reader,
-                                   DBStreamLogger* logger)
+                                   DBStreamLogger* logger, const DBStreamOptions* options)
     {
-        return new MySqlStream(host, user, passwd, database, reader, logger);
+        return new MySqlStream(host, user, passwd, database, reader, logger, options);
     }
     
+    // Used by MySqlStreamPool to give every acquired stream its own reader
+    void SetReader(DBStreamReader* reader) { mReader = reader; }
+
+    // Used by MySqlStreamPool to split the timestamp range into slices
+    bool GetTimestampRange(uint64_t timestamp_first, bool inclusive_first,
+                           uint64_t timestamp_last,  bool inclusive_last,
+                           uint64_t* timestamp_min, uint64_t* timestamp_max, uint64_t* count);
+
     //
     // Implementation of the DBStream interface
     //
@@ -49,40 +92,112 @@ public:
 
     virtual bool Write(const StreamHeader* hdr, const unsigned char* data);
     virtual bool Write(const StreamHeader* hdr, std::istream& data_stream);
+    virtual bool Open(const StreamHeader* hdr);
+    virtual bool Append(const StreamHeader* hdr, const unsigned char* data, size_t size);
+    virtual bool Seal(const StreamHeader* hdr);
+
+    virtual bool WriteBatch(const StreamHeader* hdrs, const unsigned char* const* data, size_t count);
 
     virtual bool ReadById(uint64_t id_first, bool inclusive_first,
                           uint64_t id_last,  bool inclusive_last);
+    virtual bool ReadByTimestamp(uint64_t timestamp_first, bool inclusive_first,
+                                 uint64_t timestamp_last,  bool inclusive_last);
+    virtual bool ReadRange(uint64_t id, uint64_t offset, uint64_t size, bool* found);
+    virtual bool Tail(uint64_t id, uint64_t offset, bool* found);
+
+    virtual DBStreamCursor* OpenCursorById(uint64_t id_first, bool inclusive_first,
+                                           uint64_t id_last,  bool inclusive_last);
+
+    virtual bool Follow(uint64_t id_first, bool inclusive_first);
+    virtual void StopFollow();
 
     virtual bool DeleteById(uint64_t id_first, bool inclusive_first,
                             uint64_t id_last,  bool inclusive_last);
+    virtual bool DeleteByTimestamp(uint64_t timestamp_first, bool inclusive_first,
+                                   uint64_t timestamp_last,  bool inclusive_last);
     virtual bool DeleteAll();
+    virtual bool DeleteAll(bool reset_id);
+    virtual bool DropExpired(uint64_t timestamp_before);
+    virtual bool MigrateLayout();
+
+    virtual bool PurgeById(uint64_t id_first, bool inclusive_first,
+                           uint64_t id_last,  bool inclusive_last,
+                           DBStreamPurgeProgress* progress);
+    virtual bool PurgeByTimestamp(uint64_t timestamp_first, bool inclusive_first,
+                                  uint64_t timestamp_last,  bool inclusive_last,
+                                  DBStreamPurgeProgress* progress);
 
     virtual bool GetFirst(StreamHeader* hdr);
     virtual bool GetLast(StreamHeader* hdr);
 
     virtual bool LookupById(uint64_t id, bool* found);
+    virtual bool LookupByTimestamp(uint64_t timestamp, bool* found);
 
     // Diagnostics
     virtual bool Describe();
 
 private:
+    // The written data chunks are framed (see chunkcodec.h)
+    bool IsFramed() const { return mOptions.codec != DB_STREAM_CODEC_NONE || mOptions.checksum; }
+
     bool InitDatabase(const char* database);
     bool InitTranTable(sql::DatabaseMetaData& con_meta);
     bool InitTranDataTable(sql::DatabaseMetaData& con_meta);
+    bool InitColumn(const char* table, const char* column, const char* definition);
+    bool InitIndex(const char* table, const char* index, const char* columns);
+    bool InitPartitions();
+    bool InitChunkTables(sql::DatabaseMetaData& con_meta);
+    bool GetPartitions(const char* table, std::vector<uint64_t>* bounds);
+    bool InitWriteBatch();
     bool LookupTable(sql::DatabaseMetaData& con_meta, const char* table, bool* found);
 
     bool Read(const char* column,
               uint64_t first, bool inclusive_first,
-              uint64_t last,  bool inclusive_last);
+              uint64_t last,  bool inclusive_last,
+              bool* caller_stopped=NULL, uint64_t* id_read=NULL);
     bool Delete(const char* column,
                 uint64_t first, bool inclusive_first,
                 uint64_t last,  bool inclusive_last,
                 bool reset_id=false);
+    bool Truncate(bool reset_id);
+    bool Purge(const char* column,
+               uint64_t first, bool inclusive_first,
+               uint64_t last,  bool inclusive_last,
+               DBStreamPurgeProgress* progress);
+
+    uint64_t WriteStream(const StreamHeader* hdr, std::istream& data_stream);
+    uint64_t WriteStream(const StreamHeader* hdr, const unsigned char* data);
+    uint64_t InsertStream(const StreamHeader* hdr, bool open=false);
+    sql::PreparedStatement* PrepareInsertChunks(size_t rows, std::unique_ptr<sql::PreparedStatement>& stmt);
+    sql::PreparedStatement* Prepare(const std::string& sql);
+    sql::PreparedStatement* Prepare(const std::string& sql, bool cached, std::unique_ptr<sql::PreparedStatement>& stmt);
+    sql::ResultSet* Query(const std::string& sql, const std::vector<uint64_t>& params, bool unbuffered=false);
+    void InsertData(uint64_t master_id, uint32_t seq, const unsigned char* data, uint64_t size);
+    uint64_t InsertSharedData(uint64_t master_id, std::istream& data_stream);
+    void InsertSharedChunks(uint64_t master_id, uint32_t seq, uint64_t pos,
+                            const unsigned char* data, const std::vector<size_t>& sizes);
+    void ReleaseChunks(sql::Statement* stmt, const std::string& where);
+    void DropOrphans(sql::Statement* stmt, uint64_t id_first);
+    void InsertChunks(uint64_t master_id, uint32_t seq, const unsigned char* data, const std::vector<size_t>& sizes);
 
     bool Lookup(const char* column, uint64_t val, bool* found);
     bool Get(StreamHeader* hdr, const char* order);
 
-    bool ReadData(const StreamHeader& hdr, bool* stopped);
+    bool ReadData(const StreamHeader& hdr, uint8_t format, uint64_t chunk_size, bool* stopped);
+    bool ReadBatch(const char* sql, const std::vector<uint64_t>& params,
+                   StreamHeader* hdr, size_t* count, bool* stopped);
+    bool ReadBlob(const StreamHeader& hdr, uint8_t format, uint64_t chunk_size, sql::ResultSet& res);
+    bool ReadRangeData(const StreamHeader& hdr, uint8_t format, uint64_t chunk_size,
+                       uint64_t offset, uint64_t end);
+
+    // Used by MySqlStreamCursor to fetch the stream headers and data
+    friend class MySqlStreamCursor;
+    bool ReadHeaders(uint64_t first, bool inclusive_first,
+                     uint64_t last,  bool inclusive_last,
+                     std::deque<StreamHeader>* hdrs, std::deque<std::string>* descrs,
+                     std::deque<uint8_t>* formats, std::deque<uint64_t>* chunk_sizes, bool* all_read);
+    bool ReadChunks(uint64_t master_id, uint8_t format, uint64_t chunk_size,
+                    uint64_t* chunk_id, std::deque<std::string>* chunks);
 
     // Logging support
     enum LOG_TYPE { LOG_ERR=1, LOG_INFO };
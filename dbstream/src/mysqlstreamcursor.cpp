@@ -0,0 +1,123 @@
+//
+// mysqlstreamcursor.cpp
+//
+#include <stdlib.h>
+#include <string.h>     // memcpy
+#include <algorithm>    // std::min
+#include <sstream>
+#include "mysqlstreamcursor.h"
+
+#define MODULE_NAME       "MySqlStreamCursor"
+
+//
+// MySqlStreamCursor implementation
+//
+MySqlStreamCursor::MySqlStreamCursor(MySqlStream* stream,
+                                     uint64_t id_first, bool inclusive_first,
+                                     uint64_t id_last,  bool inclusive_last)
+    : mStream(stream), mIdFirst(id_first), mInclusiveFirst(inclusive_first),
+      mIdLast(id_last), mInclusiveLast(inclusive_last)
+{
+}
+
+bool MySqlStreamCursor::Next(StreamHeader* hdr, bool* found)
+{
+    if(hdr == NULL || found == NULL)
+        return false;
+
+    *found = false;
+
+    if(mHeaders.empty() && !mAllFetched)
+    {
+        // Fetch the next page of headers
+        if(!mStream->ReadHeaders(mIdFirst, mInclusiveFirst, mIdLast, mInclusiveLast,
+                                 &mHeaders, &mDescrs, &mFormats, &mChunkSizes, &mAllFetched))
+            return false;
+
+        if(!mHeaders.empty())
+        {
+            mIdFirst = mHeaders.back().id;
+            mInclusiveFirst = false;
+        }
+    }
+
+    if(mHeaders.empty())
+    {
+        // No more streams
+        mId = 0;
+        mDataEnd = true;
+        return true;
+    }
+
+    *hdr = mHeaders.front();
+    mDescr = mDescrs.front();
+    mFormat = mFormats.front();
+    mChunkSize = mChunkSizes.front();
+    mHeaders.pop_front();
+    mDescrs.pop_front();
+    mFormats.pop_front();
+    mChunkSizes.pop_front();
+
+    hdr->descr = mDescr.c_str();
+    *found = true;
+
+    // Start reading the stream data from its first chunk
+    mId = hdr->id;
+    mChunkId = 0;
+    mChunks.clear();
+    mChunkPos = 0;
+    mDataLeft = hdr->size;
+    mDataEnd = (hdr->size == 0);
+    return true;
+}
+
+bool MySqlStreamCursor::ReadChunk(unsigned char* buf, size_t buf_size, size_t* size)
+{
+    if(buf == NULL || buf_size == 0 || size == NULL)
+        return false;
+
+    *size = 0;
+
+    if(!mChunks.empty() && mChunkPos == mChunks.front().size())
+    {
+        mChunks.pop_front();
+        mChunkPos = 0;
+    }
+
+    if(mChunks.empty())
+    {
+        if(mDataEnd)
+            return true; // No more data of the current stream
+
+        // Fetch the next data chunks
+        if(!mStream->ReadChunks(mId, mFormat, mChunkSize, &mChunkId, &mChunks))
+            return false;
+
+        if(mChunks.empty())
+        {
+            mDataEnd = true;
+
+            // The stream was deleted while reading it
+            if(mDataLeft > 0)
+            {
+                std::stringstream msg;
+                msg << "ERROR: " << MODULE_NAME << ": The stream id=" << mId << " ended "
+                    << mDataLeft << " bytes short of its size";
+                mStream->WriteToLog(MySqlStream::LOG_ERR, msg);
+                return false;
+            }
+
+            return true;
+        }
+
+        for(const std::string& chunk : mChunks)
+            mDataLeft -= std::min<uint64_t>(mDataLeft, chunk.size());
+    }
+
+    // Return as much of the chunk as fits into the buffer
+    const std::string& chunk = mChunks.front();
+    *size = std::min(buf_size, chunk.size() - mChunkPos);
+    memcpy(buf, chunk.data() + mChunkPos, *size);
+    mChunkPos += *size;
+    return true;
+}
@@ -0,0 +1,75 @@
+//
+// mysqlstreamcursor.h
+//
+
+#ifndef _MYSQLSTREAMCURSOR_H_
+#define _MYSQLSTREAMCURSOR_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include "mysqlstream.h"
+
+//
+// Cursor over the streams of an id range of MySQL stream. It fetches the
+// stream headers a page at a time and the data a write batch of chunks at
+// a time, so at most write_batch_size bytes are read ahead of the caller.
+//
+class MySqlStreamCursor : public DBStreamCursor
+{
+private:
+    // Private constructor/destructor to force using Create/Close methods
+    MySqlStreamCursor(MySqlStream* stream,
+                      uint64_t id_first, bool inclusive_first,
+                      uint64_t id_last,  bool inclusive_last);
+    virtual ~MySqlStreamCursor() = default;
+    MySqlStreamCursor& operator=(const MySqlStreamCursor&) = delete; // Don't allow class copy
+
+    // Class data
+private:
+    MySqlStream* mStream = NULL;
+
+    // Range of the streams left to fetch
+    uint64_t mIdFirst = 0;
+    bool mInclusiveFirst = true;
+    uint64_t mIdLast = 0;
+    bool mInclusiveLast = true;
+    bool mAllFetched = false;
+
+    // Fetched stream headers not yet returned by Next()
+    std::deque<StreamHeader> mHeaders;
+    std::deque<std::string> mDescrs;
+    std::deque<uint8_t> mFormats;
+    std::deque<uint64_t> mChunkSizes;
+
+    // Current stream and the part of its data chunks not yet returned by
+    // ReadChunk(), the front chunk is returned from mChunkPos on
+    uint64_t mId = 0;
+    std::string mDescr;
+    uint8_t mFormat = 0;
+    uint64_t mChunkSize = 0;
+    uint64_t mChunkId = 0;
+    std::deque<std::string> mChunks;
+    size_t mChunkPos = 0;
+    uint64_t mDataLeft = 0;     // Bytes of the stream not yet fetched
+    bool mDataEnd = true;
+
+    // Methods
+public:
+    static MySqlStreamCursor* Create(MySqlStream* stream,
+                                     uint64_t id_first, bool inclusive_first,
+                                     uint64_t id_last,  bool inclusive_last)
+    {
+        return new MySqlStreamCursor(stream, id_first, inclusive_first, id_last, inclusive_last);
+    }
+
+    //
+    // Implementation of the DBStreamCursor interface
+    //
+    virtual bool Next(StreamHeader* hdr, bool* found);
+    virtual bool ReadChunk(unsigned char* buf, size_t buf_size, size_t* size);
+    virtual void Close() { /*(this != NULL)*/ delete this; }
+};
+
+#endif // _MYSQLSTREAMCURSOR_H_
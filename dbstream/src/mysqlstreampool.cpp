@@ -0,0 +1,416 @@
+//
+// mysqlstreampool.cpp
+//
+#include <stdlib.h>
+#include <algorithm>    // std::find, std::min
+#include <string>
+#include <thread>
+#include <atomic>
+#include "mysqlstreampool.h"
+
+#include <driver/mysql_driver.h>
+
+#define MODULE_NAME       "MySqlStreamPool"
+
+DBStreamPool* CreateDBStreamPool(const char* host, const char* user, const char* passwd,
+                                 const char* database, DBStreamReader* reader,
+                                 DBStreamLogger* logger, const DBStreamOptions* options,
+                                 size_t size)
+{
+    MySqlStreamPool* mysqlStreamPool = MySqlStreamPool::Create(host, user, passwd, database,
+                                                               reader, logger, options, size);
+
+    if(mysqlStreamPool != NULL && !mysqlStreamPool->IsValid())
+    {
+        mysqlStreamPool->Destroy();
+        mysqlStreamPool = NULL;
+    }
+
+    return mysqlStreamPool;
+}
+
+//
+// MySqlStreamPool implementation
+//
+MySqlStreamPool::MySqlStreamPool(const char* host, const char* user, const char* passwd,
+                                 const char* database, DBStreamReader* reader,
+                                 DBStreamLogger* logger, const DBStreamOptions* options,
+                                 size_t size) : mReader(reader), mLogger(logger)
+{
+    DBStreamLogger* streamLogger = (logger != NULL ? &mLogger : NULL);
+
+    if(options != NULL && options->parallel_slice_size > 0)
+        mSliceSize = options->parallel_slice_size;
+    else if(options == NULL)
+        mSliceSize = DBStreamOptions().parallel_slice_size;
+
+    if(options != NULL && options->parallel_buffer_size > 0)
+        mBufferSize = options->parallel_buffer_size;
+    else if(options == NULL)
+        mBufferSize = DBStreamOptions().parallel_buffer_size;
+
+    // Open all connections up front, so Acquire() never has to connect
+    for(size_t i = 0; i < size; i++)
+    {
+        MySqlStream* mysqlStream = MySqlStream::Create(host, user, passwd, database,
+                                                       reader, streamLogger, options);
+        if(mysqlStream == NULL)
+            break;
+
+        if(!mysqlStream->IsValid())
+        {
+            mysqlStream->Destroy();
+            break;
+        }
+
+        mStreams.push_back(mysqlStream);
+    }
+
+    if(mStreams.size() < size)
+    {
+        // Don't give out partial pool
+        for(MySqlStream* mysqlStream : mStreams)
+            mysqlStream->Destroy();
+        mStreams.clear();
+    }
+
+    mFree = mStreams;
+}
+
+MySqlStreamPool::~MySqlStreamPool()
+{
+    // Note: All acquired streams are expected to be released by now
+    for(MySqlStream* mysqlStream : mStreams)
+        mysqlStream->Destroy();
+}
+
+// Initializes the MySql client library for the thread,
+// and releases it when the thread exits
+struct MySqlThreadInit
+{
+    MySqlThreadInit()  { sql::mysql::get_driver_instance()->threadInit(); }
+    ~MySqlThreadInit() { sql::mysql::get_driver_instance()->threadEnd(); }
+};
+
+DBStream* MySqlStreamPool::Acquire(DBStreamReader* reader)
+{
+    // Make sure the MySql client library is initialized for the calling thread,
+    // once per thread however many times it acquires
+    static thread_local MySqlThreadInit threadInit;
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mFreeCond.wait(lock, [this] { return !mFree.empty(); });
+
+    MySqlStream* mysqlStream = mFree.back();
+    mFree.pop_back();
+
+    mysqlStream->SetReader(reader != NULL ? reader : mReader);
+    return mysqlStream;
+}
+
+void MySqlStreamPool::Release(DBStream* stream)
+{
+    if(stream == NULL)
+        return;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    // Ignore the stream that doesn't belong to the pool
+    MySqlStream* mysqlStream = static_cast<MySqlStream*>(stream);
+    if(std::find(mStreams.begin(), mStreams.end(), stream) == mStreams.end() ||
+       std::find(mFree.begin(), mFree.end(), stream) != mFree.end())
+        return;
+
+    mysqlStream->SetReader(mReader);
+    mFree.push_back(mysqlStream);
+    mFreeCond.notify_one();
+}
+
+
+//
+// State shared by the threads of ReadById() and ReadByTimestamp()
+//
+struct MySqlStreamPool::ParallelRead
+{
+    bool byTimestamp = false;
+    uint64_t first = 0;             // First id/timestamp of the range (inclusive)
+    uint64_t last = 0;              // Last id/timestamp of the range (inclusive)
+    uint64_t width = 1;             // Ids/timestamps per slice
+    size_t slices = 0;
+    bool ordered = false;
+
+    std::atomic<size_t> nextSlice{0};
+    std::atomic<bool> stopped{false};
+    std::atomic<bool> failed{false};
+
+    // Ordered reading: the slice to be passed to the pool reader next,
+    // and the bytes the later slices keep until it is their turn
+    size_t nextDelivery = 0;
+    size_t buffered = 0;
+    size_t bufferLimit = 0;
+    std::mutex mutex;
+    std::condition_variable cond;
+};
+
+//
+// Reader of the slices of one pool stream. Unordered reading and the slice
+// next in line pass the streams right away to the pool reader, the later
+// slices keep them until it is their turn (or there is no room to keep more).
+//
+struct MySqlStreamPool::SliceReader : public DBStreamReader
+{
+    struct Event
+    {
+        StreamHeader hdr;
+        std::string descr;
+        std::vector<unsigned char> data;
+        int state;
+    };
+
+    SliceReader(DBStreamReader* reader, ParallelRead& read)
+        : mReader(reader), mRead(read) {}
+
+    void Begin(size_t slice)
+    {
+        mSlice = slice;
+        mDelivering = !mRead.ordered;
+    }
+
+    virtual bool OnRead(const StreamHeader* hdr,
+                        unsigned char* data, size_t size,
+                        int reading_state)
+    {
+        if(mDelivering)
+            return Deliver(hdr, data, size, reading_state);
+
+        {
+            std::unique_lock<std::mutex> lock(mRead.mutex);
+            mRead.cond.wait(lock, [this, size] {
+                return mRead.nextDelivery == mSlice || mRead.stopped || mRead.failed ||
+                       mRead.buffered + size <= mRead.bufferLimit; });
+
+            if(mRead.nextDelivery != mSlice)
+            {
+                if(mRead.stopped || mRead.failed)
+                    return false;
+
+                mEvents.emplace_back();
+                Event& event = mEvents.back();
+                event.hdr = *hdr;
+                event.descr = (hdr->descr != NULL ? hdr->descr : "");
+                event.data.assign(data, data + size);
+                event.state = reading_state;
+
+                mBytes += size;
+                mRead.buffered += size;
+                return true;
+            }
+        }
+
+        // The turn of this slice, from now on pass the streams right away
+        Replay();
+        mDelivering = true;
+        return Deliver(hdr, data, size, reading_state);
+    }
+
+    // Called when the slice is read (or failed): wait for its turn to pass
+    // the kept streams to the pool reader, and let the next slice go on
+    void End()
+    {
+        if(!mRead.ordered)
+            return;
+
+        if(!mDelivering)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mRead.mutex);
+                mRead.cond.wait(lock, [this] { return mRead.nextDelivery == mSlice; });
+            }
+
+            if(!mRead.failed)
+                Replay();
+            else
+                Discard();
+        }
+
+        std::lock_guard<std::mutex> lock(mRead.mutex);
+        mRead.nextDelivery++;
+        mRead.cond.notify_all();
+    }
+
+private:
+    // Pass the stream event to the pool reader. If the reader stops reading,
+    // the current stream still gets DB_STREAM_READ_END.
+    bool Deliver(const StreamHeader* hdr, unsigned char* data, size_t size, int reading_state)
+    {
+        if(mRead.stopped)
+        {
+            if(mOpen && reading_state == DB_STREAM_READ_END)
+            {
+                mReader->OnRead(hdr, data, size, reading_state);
+                mOpen = false;
+            }
+            return false;
+        }
+
+        bool keepReading = mReader->OnRead(hdr, data, size, reading_state);
+        mOpen = (reading_state != DB_STREAM_READ_END);
+
+        if(!keepReading && reading_state != DB_STREAM_READ_END)
+            mRead.stopped = true;
+        return !mRead.stopped;
+    }
+
+    // Pass the kept streams to the pool reader and free their room
+    void Replay()
+    {
+        for(Event& event : mEvents)
+        {
+            event.hdr.descr = event.descr.c_str();
+            Deliver(&event.hdr, event.data.data(), event.data.size(), event.state);
+        }
+
+        Discard();
+    }
+
+    void Discard()
+    {
+        mEvents.clear();
+
+        std::lock_guard<std::mutex> lock(mRead.mutex);
+        mRead.buffered -= mBytes;
+        mBytes = 0;
+        mRead.cond.notify_all();
+    }
+
+    DBStreamReader* mReader;
+    ParallelRead& mRead;
+    size_t mSlice = 0;
+    bool mDelivering = false;   // Passing the streams right away
+    bool mOpen = false;         // Stream begun but not yet ended for the pool reader
+    size_t mBytes = 0;          // Bytes kept by this reader
+    std::vector<Event> mEvents;
+};
+
+bool MySqlStreamPool::ReadById(uint64_t id_first, bool inclusive_first,
+                               uint64_t id_last,  bool inclusive_last,
+                               bool ordered)
+{
+    if(mReader == NULL)
+    {
+        WriteToLog("ERROR: " MODULE_NAME ": ReadById: The pool has no reader");
+        return false;
+    }
+
+    // Find the actual id range, so it can be split into slices
+    StreamHeader hdrFirst{};
+    StreamHeader hdrLast{};
+    DBStream* stream = Acquire(NULL);
+    bool ok = stream->GetFirst(&hdrFirst) && stream->GetLast(&hdrLast);
+    Release(stream);
+
+    if(!ok)
+        return false;
+
+    ParallelRead read;
+    read.ordered = ordered;
+    read.first = std::max(hdrFirst.id, (inclusive_first || id_first == UINT64_MAX ? id_first : id_first + 1));
+    read.last = hdrLast.id;
+    if(id_last > 0)
+        read.last = std::min(read.last, (inclusive_last ? id_last : id_last - 1));
+
+    if(hdrFirst.id == 0 || read.first > read.last)
+        return true; // Nothing to read
+
+    uint64_t range = read.last - read.first;
+    read.slices = range / mSliceSize + 1;
+    read.width = mSliceSize;
+
+    return Read(read);
+}
+
+bool MySqlStreamPool::ReadByTimestamp(uint64_t timestamp_first, bool inclusive_first,
+                                      uint64_t timestamp_last,  bool inclusive_last,
+                                      bool ordered)
+{
+    if(mReader == NULL)
+    {
+        WriteToLog("ERROR: " MODULE_NAME ": ReadByTimestamp: The pool has no reader");
+        return false;
+    }
+
+    // Find the actual timestamp range and the number of its streams,
+    // so it can be split into slices of mSliceSize streams on average
+    uint64_t timestampMin = 0;
+    uint64_t timestampMax = 0;
+    uint64_t count = 0;
+    MySqlStream* stream = static_cast<MySqlStream*>(Acquire(NULL));
+    bool ok = stream->GetTimestampRange(timestamp_first, inclusive_first, timestamp_last, inclusive_last,
+                                        &timestampMin, &timestampMax, &count);
+    Release(stream);
+
+    if(!ok)
+        return false;
+
+    if(count == 0)
+        return true; // Nothing to read
+
+    ParallelRead read;
+    read.byTimestamp = true;
+    read.ordered = ordered;
+    read.first = timestampMin;
+    read.last = timestampMax;
+    read.slices = count / mSliceSize + 1;
+    read.width = (read.last - read.first) / read.slices + 1;
+    read.slices = (read.last - read.first) / read.width + 1;
+
+    return Read(read);
+}
+
+bool MySqlStreamPool::Read(ParallelRead& read)
+{
+    read.bufferLimit = mBufferSize;
+
+    // Every thread reads the next slice not yet taken by the others
+    std::vector<std::thread> threads;
+    size_t count = std::min(mStreams.size(), read.slices);
+    for(size_t i = 0; i < count; i++)
+        threads.emplace_back(&MySqlStreamPool::ReadSlices, this, std::ref(read));
+
+    for(std::thread& thread : threads)
+        thread.join();
+
+    return !read.failed;
+}
+
+void MySqlStreamPool::ReadSlices(ParallelRead& read)
+{
+    SliceReader reader(mReader, read);
+    DBStream* stream = Acquire(&reader);
+
+    while(true)
+    {
+        // The slices are taken in order, so every earlier slice
+        // is already taken by some thread when this one waits its turn
+        size_t slice = read.nextSlice++;
+        if(slice >= read.slices)
+            break;
+
+        reader.Begin(slice);
+
+        if(!read.stopped && !read.failed)
+        {
+            uint64_t first = read.first + slice * read.width;
+            uint64_t last = std::min(read.last, first + (read.width - 1));
+
+            bool ok = (read.byTimestamp ? stream->ReadByTimestamp(first, true, last, true) :
+                                          stream->ReadById(first, true, last, true));
+            if(!ok)
+                read.failed = true;
+        }
+
+        reader.End();
+    }
+
+    Release(stream);
+}
@@ -0,0 +1,76 @@
+//
+// mysqlstreampool.h
+//
+
+#ifndef _MYSQLSTREAMPOOL_H_
+#define _MYSQLSTREAMPOOL_H_
+
+#include <stdlib.h>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include "mysqlstream.h"
+#include "synclogger.h"
+
+//
+// Pool of MySQL streams, each one with its own connection
+//
+class MySqlStreamPool : public DBStreamPool
+{
+private:
+    // Private constructor/destructor to force using Create/Destroy methods
+    MySqlStreamPool(const char* host, const char* user, const char* passwd,
+                    const char* database, DBStreamReader* reader,
+                    DBStreamLogger* logger, const DBStreamOptions* options,
+                    size_t size);
+    virtual ~MySqlStreamPool();
+    MySqlStreamPool& operator=(const MySqlStreamPool&) = delete; // Don't allow class copy
+
+    // Class data
+private:
+    DBStreamReader* mReader = NULL;
+    SyncLogger mLogger;
+    size_t mSliceSize = 1;
+    size_t mBufferSize = 1;             // Max bytes buffered by the ordered reading
+    std::vector<MySqlStream*> mStreams; // All streams of the pool
+    std::vector<MySqlStream*> mFree;    // Streams available to acquire
+    std::mutex mMutex;
+    std::condition_variable mFreeCond;
+
+    // Methods
+public:
+    static MySqlStreamPool* Create(const char* host, const char* user, const char* passwd,
+                                   const char* database, DBStreamReader* reader,
+                                   DBStreamLogger* logger, const DBStreamOptions* options,
+                                   size_t size)
+    {
+        return new MySqlStreamPool(host, user, passwd, database, reader, logger, options, size);
+    }
+
+    //
+    // Implementation of the DBStreamPool interface
+    //
+    virtual bool IsValid() { return !mStreams.empty(); }
+    virtual void Destroy() { /*(this != NULL)*/ delete this; }
+
+    virtual DBStream* Acquire(DBStreamReader* reader);
+    virtual void Release(DBStream* stream);
+
+    virtual bool ReadById(uint64_t id_first, bool inclusive_first,
+                          uint64_t id_last,  bool inclusive_last,
+                          bool ordered);
+    virtual bool ReadByTimestamp(uint64_t timestamp_first, bool inclusive_first,
+                                 uint64_t timestamp_last,  bool inclusive_last,
+                                 bool ordered);
+
+private:
+    struct ParallelRead;
+    struct SliceReader;
+    bool Read(ParallelRead& read);
+    void ReadSlices(ParallelRead& read);
+
+    void WriteToLog(const char* err) { if(mLogger.mLogger != NULL) mLogger.OnLogError(err); }
+};
+
+#endif // _MYSQLSTREAMPOOL_H_
+
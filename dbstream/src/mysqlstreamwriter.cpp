@@ -0,0 +1,179 @@
+//
+// mysqlstreamwriter.cpp
+//
+#include <stdlib.h>
+#include <string.h>     // memcpy
+#include <chrono>
+#include "mysqlstreamwriter.h"
+
+#include <driver/mysql_driver.h>
+
+#define MODULE_NAME       "MySqlStreamWriter"
+
+DBStreamWriter* CreateDBStreamWriter(const char* host, const char* user, const char* passwd,
+                                     const char* database, DBStreamLogger* logger,
+                                     const DBStreamOptions* options, size_t queue_size)
+{
+    MySqlStreamWriter* mysqlStreamWriter = MySqlStreamWriter::Create(host, user, passwd, database,
+                                                                     logger, options, queue_size);
+
+    if(mysqlStreamWriter != NULL && !mysqlStreamWriter->IsValid())
+    {
+        mysqlStreamWriter->Destroy();
+        mysqlStreamWriter = NULL;
+    }
+
+    return mysqlStreamWriter;
+}
+
+//
+// MySqlStreamWriter implementation
+//
+MySqlStreamWriter::MySqlStreamWriter(const char* host, const char* user, const char* passwd,
+                                     const char* database, DBStreamLogger* logger,
+                                     const DBStreamOptions* options, size_t queue_size)
+    : mLogger(logger), mQueueSize(queue_size)
+{
+    DBStreamOptions defaultOptions;
+    if(options == NULL)
+        options = &defaultOptions;
+
+    mGroupSize = (options->group_commit_size > 0 ? options->group_commit_size : 1);
+    mGroupLatency = options->group_commit_latency;
+
+    mStream = MySqlStream::Create(host, user, passwd, database, NULL,
+                                  (logger != NULL ? &mLogger : NULL), options);
+
+    if(mStream != NULL && !mStream->IsValid())
+    {
+        mStream->Destroy();
+        mStream = NULL;
+    }
+
+    if(mStream != NULL && mQueueSize > 0)
+        mThread = std::thread(&MySqlStreamWriter::Run, this);
+}
+
+MySqlStreamWriter::~MySqlStreamWriter()
+{
+    if(mThread.joinable())
+    {
+        // Let the thread write all queued streams and exit
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+        }
+
+        mQueueCond.notify_one();
+        mThread.join();
+    }
+
+    if(mStream != NULL)
+        mStream->Destroy();
+}
+
+std::future<uint64_t> MySqlStreamWriter::Write(const StreamHeader* hdr, const unsigned char* data)
+{
+    Item item;
+    std::future<uint64_t> result = item.promise.get_future();
+
+    if(hdr == NULL || (data == NULL && hdr->size > 0))
+    {
+        WriteToLog("ERROR: " MODULE_NAME ": Write: Invalid StreamHeader* hdr or data");
+        item.promise.set_value(0);
+        return result;
+    }
+
+    // Copy the stream outside of the lock, so the producers
+    // don't wait for each other while copying
+    item.hdr = *hdr;
+    item.descr = (hdr->descr != NULL ? hdr->descr : "");
+    item.data.resize(hdr->size);
+    if(hdr->size > 0)
+        memcpy(item.data.data(), data, hdr->size);
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        if(mQueue.size() < mQueueSize)
+        {
+            mQueue.push_back(std::move(item));
+            mQueueCond.notify_one();
+            return result;
+        }
+    }
+
+    // Don't block the caller when the queue is full
+    WriteToLog("ERROR: " MODULE_NAME ": Write: The queue is full");
+    item.promise.set_value(0);
+    return result;
+}
+
+void MySqlStreamWriter::Flush()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mFlushCond.wait(lock, [this] { return mQueue.empty() && mBusy == 0; });
+}
+
+void MySqlStreamWriter::Run()
+{
+    // Make sure the MySql client library is initialized for this thread
+    sql::mysql::get_driver_instance()->threadInit();
+
+    std::vector<Item> items;
+    std::vector<StreamHeader> hdrs;
+    std::vector<const unsigned char*> data;
+
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    while(true)
+    {
+        mQueueCond.wait(lock, [this] { return !mQueue.empty() || mStop; });
+
+        if(mQueue.empty())
+            break; // Stopped and nothing left to write
+
+        // Give the producers a chance to fill up the whole group, so all
+        // of its streams are written with a single commit
+        if(mGroupSize > 1 && mGroupLatency > 0)
+        {
+            mQueueCond.wait_for(lock, std::chrono::milliseconds(mGroupLatency),
+                [this] { return mQueue.size() >= mGroupSize || mStop; });
+        }
+
+        items.clear();
+        while(!mQueue.empty() && items.size() < mGroupSize)
+        {
+            items.push_back(std::move(mQueue.front()));
+            mQueue.pop_front();
+        }
+
+        mBusy += items.size();
+        lock.unlock();
+
+        // Note: Set the description pointers only now, as the
+        // std::string moves could have invalidated them
+        hdrs.clear();
+        data.clear();
+        for(Item& item : items)
+        {
+            item.hdr.descr = item.descr.c_str();
+            hdrs.push_back(item.hdr);
+            data.push_back(item.data.data());
+        }
+
+        bool result = mStream->WriteBatch(hdrs.data(), data.data(), hdrs.size());
+
+        for(size_t i = 0; i < items.size(); i++)
+            items[i].promise.set_value(result ? hdrs[i].id : 0);
+
+        lock.lock();
+        mBusy -= items.size();
+
+        if(mQueue.empty() && mBusy == 0)
+            mFlushCond.notify_all();
+    }
+
+    sql::mysql::get_driver_instance()->threadEnd();
+}
+
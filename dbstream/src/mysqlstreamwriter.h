@@ -0,0 +1,79 @@
+//
+// mysqlstreamwriter.h
+//
+
+#ifndef _MYSQLSTREAMWRITER_H_
+#define _MYSQLSTREAMWRITER_H_
+
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "mysqlstream.h"
+#include "synclogger.h"
+
+//
+// Asynchronous MySQL stream writer
+//
+class MySqlStreamWriter : public DBStreamWriter
+{
+private:
+    // Private constructor/destructor to force using Create/Destroy methods
+    MySqlStreamWriter(const char* host, const char* user, const char* passwd,
+                      const char* database, DBStreamLogger* logger,
+                      const DBStreamOptions* options, size_t queue_size);
+    virtual ~MySqlStreamWriter();
+    MySqlStreamWriter& operator=(const MySqlStreamWriter&) = delete; // Don't allow class copy
+
+    // Queued stream
+    struct Item
+    {
+        StreamHeader hdr;
+        std::string descr;
+        std::vector<unsigned char> data;
+        std::promise<uint64_t> promise;
+    };
+
+    // Class data
+private:
+    SyncLogger mLogger;
+    MySqlStream* mStream = NULL;
+    size_t mQueueSize = 0;
+    size_t mGroupSize = 1;      // Max streams written with a single commit
+    size_t mGroupLatency = 0;   // Max milliseconds to wait for the group to fill up
+    std::deque<Item> mQueue;
+    size_t mBusy = 0;           // Number of streams being written
+    bool mStop = false;
+    std::mutex mMutex;
+    std::condition_variable mQueueCond;
+    std::condition_variable mFlushCond;
+    std::thread mThread;
+
+    // Methods
+public:
+    static MySqlStreamWriter* Create(const char* host, const char* user, const char* passwd,
+                                     const char* database, DBStreamLogger* logger,
+                                     const DBStreamOptions* options, size_t queue_size)
+    {
+        return new MySqlStreamWriter(host, user, passwd, database, logger, options, queue_size);
+    }
+
+    //
+    // Implementation of the DBStreamWriter interface
+    //
+    virtual bool IsValid() { return mThread.joinable(); }
+    virtual void Destroy() { /*(this != NULL)*/ delete this; }
+
+    virtual std::future<uint64_t> Write(const StreamHeader* hdr, const unsigned char* data);
+    virtual void Flush();
+
+private:
+    void Run();
+    void WriteToLog(const char* err) { if(mLogger.mLogger != NULL) mLogger.OnLogError(err); }
+};
+
+#endif // _MYSQLSTREAMWRITER_H_
+
@@ -107,9 +107,11 @@ void StreamReader::Read()
     {
         mRowCount = 0;
 
-        cout << "StreamReader: Reading all records from id=" << mId_last + 1 << " ..." << endl;
+        cout << "StreamReader: Following records from id=" << mId_last + 1 << " ..." << endl;
 
-        mDBStream->ReadById(mId_last + 1, true, 0, true);
+        // Follow() only returns when OnRead() fails, then
+        // resume from the last successfully read record
+        mDBStream->Follow(mId_last, false);
 
         sleep(1);
     }
@@ -0,0 +1,93 @@
+//
+// sha256.h
+//
+
+#ifndef _SHA256_H_
+#define _SHA256_H_
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+//
+// SHA-256 (FIPS 180-4) of the shared chunks (see chunkdedup.h)
+//
+struct Sha256
+{
+    static const size_t DIGEST_SIZE = 32;
+
+    static void Compute(const unsigned char* data, size_t size, unsigned char digest[DIGEST_SIZE])
+    {
+        uint32_t state[8] = { 0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+                              0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19 };
+
+        const uint64_t bits = (uint64_t)size * 8;
+        for(; size >= 64; data += 64, size -= 64)
+            Transform(state, data);
+
+        // Pad the rest with 0x80, zeros and the bit length to one or two blocks
+        unsigned char block[128] = {0};
+        memcpy(block, data, size);
+        block[size] = 0x80;
+
+        size_t blocks = (size < 56 ? 1 : 2);
+        for(int i = 0; i < 8; i++)
+            block[blocks * 64 - 1 - i] = (unsigned char)(bits >> (i * 8));
+
+        for(size_t i = 0; i < blocks; i++)
+            Transform(state, block + i * 64);
+
+        for(int i = 0; i < 8; i++)
+        {
+            digest[i * 4]     = (unsigned char)(state[i] >> 24);
+            digest[i * 4 + 1] = (unsigned char)(state[i] >> 16);
+            digest[i * 4 + 2] = (unsigned char)(state[i] >> 8);
+            digest[i * 4 + 3] = (unsigned char)(state[i]);
+        }
+    }
+
+private:
+    static uint32_t Rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    static void Transform(uint32_t state[8], const unsigned char* p)
+    {
+        static const uint32_t K[64] =
+        {
+            0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+            0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+            0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+            0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+            0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+            0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+            0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+            0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+        };
+
+        uint32_t w[64];
+        for(int i = 0; i < 16; i++)
+            w[i] = ((uint32_t)p[i * 4] << 24) | ((uint32_t)p[i * 4 + 1] << 16) | ((uint32_t)p[i * 4 + 2] << 8) | p[i * 4 + 3];
+
+        for(int i = 16; i < 64; i++)
+        {
+            uint32_t s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for(int i = 0; i < 64; i++)
+        {
+            uint32_t t1 = h + (Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            uint32_t t2 = (Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+};
+
+#endif // _SHA256_H_
@@ -0,0 +1,27 @@
+//
+// synclogger.h
+//
+
+#ifndef _SYNCLOGGER_H_
+#define _SYNCLOGGER_H_
+
+#include <mutex>
+#include "dbstream.h"
+
+//
+// Logger to serialize logging from multiple threads
+//
+struct SyncLogger : public DBStreamLogger
+{
+    SyncLogger(DBStreamLogger* logger) : mLogger(logger) {}
+
+    virtual bool IsValid() { return mLogger->IsValid(); }
+    virtual void OnLogInfo(const char* msg) { std::lock_guard<std::mutex> lock(mMutex); mLogger->OnLogInfo(msg); }
+    virtual void OnLogError(const char* err) { std::lock_guard<std::mutex> lock(mMutex); mLogger->OnLogError(err); }
+
+    DBStreamLogger* mLogger = NULL;
+    std::mutex mMutex;
+};
+
+#endif // _SYNCLOGGER_H_
+
@@ -5,7 +5,14 @@
 #include <iostream>     // std::cout
 #include <sstream>      // std::stringstream
 #include <fstream>      // std::ifstream
-#include <algorithm>    // std::replace
+#include <algorithm>    // std::replace, std::find, std::min, std::max, std::equal
+#include <vector>       // std::vector
+#include <map>          // std::map
+#include <thread>       // std::thread
+#include <mutex>        // std::mutex
+#include <condition_variable> // std::condition_variable
+#include <atomic>       // std::atomic
+#include <chrono>       // std::chrono
 #include <dirent.h>
 #include <sys/stat.h>   // stat
 #include <sys/time.h>   // gettimeofday
@@ -24,6 +31,90 @@
 
 using namespace std;
 
+//
+// Thread-safe reader to count the read streams, for the tests that read
+// on other threads or stop reading half way
+//
+class StreamCounter : public DBStreamReader
+{
+public:
+    StreamCounter(bool ordered, size_t stop_after = 0) : mOrdered(ordered), mStopAfter(stop_after) {}
+
+    // Wait until count streams are read or timeout
+    size_t Wait(size_t count, size_t timeout_ms)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCond.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this, count] { return mCount >= count; });
+        return mCount;
+    }
+
+    // Count from zero again, and don't stop anymore
+    void Reset()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mCount = 0;
+        mSize = 0;
+        mPieces = 0;
+        mLastId = 0;
+        mStopAfter = 0;
+        mStopped = false;
+        mError = false;
+    }
+
+    size_t mCount = 0;          // Streams read
+    uint64_t mSize = 0;         // Bytes read
+    size_t mPieces = 0;         // Data pieces read
+    uint64_t mLastId = 0;
+    bool mOrdered = false;      // The streams are expected in id order
+    size_t mStopAfter = 0;      // Stop reading after that many data pieces (0 for never)
+    bool mStopped = false;
+    bool mError = false;        // Not in id order or not of the size
+
+private:
+    std::mutex mMutex;
+    std::condition_variable mCond;
+
+    //
+    // Implementation of DBStreamReader interface
+    //
+    virtual bool OnRead(const StreamHeader* hdr,
+                        unsigned char* data, size_t size,
+                        int reading_state)
+    {
+        // Every stream is read by the same thread from begin to end
+        thread_local uint64_t read_size = 0;
+
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        switch(reading_state)
+        {
+        case DB_STREAM_READ_BEGIN:
+            read_size = 0;
+            if(mOrdered && hdr->id <= mLastId)
+                mError = true;
+            mLastId = hdr->id;
+            break;
+
+        case DB_STREAM_READ_DATA:
+            read_size += size;
+            mSize += size;
+            mPieces++;
+            if(mStopAfter > 0 && mPieces >= mStopAfter)
+                mStopped = true;
+            break;
+
+        case DB_STREAM_READ_END:
+            if(read_size != hdr->size && !mStopped)
+                mError = true;
+            mCount++;
+            mCond.notify_all();
+            break;
+        }
+
+        return !mStopped;
+    }
+};
+
 //
 // DBStreamClient class to demonstrate working with DBStream
 //
@@ -62,6 +153,9 @@ public:
 
         cout << __func__ << ": " << "mDBStream=" << mDBStream << endl;
 
+        mHost = host;
+        mUser = user;
+        mPasswd = passwd;
         mDatabase = database;
     }
     
@@ -87,15 +181,63 @@ public:
     void WriteFile(const char* filename);
     void WriteFileLarge(const char* filename);
     void Read();
+    void ReadCursor();
     void Lookup();
     void Delete();
     void Describe();
+
+    // Tests of the DB stream features, every failure is counted
+    bool Verify(bool ok) { if(!ok) mFailures++; return ok; }
+    void TestReadModes();
+    void TestUnbuffered();
+    void TestWriteBatches();
+    void TestChunkSizes();
+    void TestPool();
+    void TestSnapshot();
+    void TestWriter();
+    void TestWriteBatch();
+    void TestFollow();
+    void TestCursor();
+    void TestParallelRead();
+    void TestTimestamps();
+    void TestRetention(const char* database);
+    void TestDeleteAll();
+    void TestPurge();
+    void TestWriteHeader();
+    void TestStatements();
+    void TestWriteBuffer();
+    void TestReadDirect();
+    void TestCompression();
+    void TestMigrateLayout(const char* database);
+    void TestReadRange();
+    void TestOpenStreams();
+    void TestDedup();
+    void TestChecksums();
     
     void* mMySqlLib = nullptr;
     struct DBStream* mDBStream = nullptr;
+    std::string mHost;
+    std::string mUser;
+    std::string mPasswd;
     std::string mDatabase; 
 
+    std::atomic<size_t> mFailures{0};
+
+    // Checksums of the streams written by the tests, verified on read
+    std::map<uint64_t, uint64_t> mChecksums;
+    std::mutex mChecksumsMutex; // Guards mChecksums written by the test threads
+
 private:
+    DBStream* CreateStream(const DBStreamOptions& options, DBStreamReader* reader = NULL,
+                           const char* database = NULL);
+    uint64_t WriteData(DBStream* stream, const char* descr,
+                       const std::vector<unsigned char>& data, uint64_t timestamp = 0);
+    bool WriteTestData(DBStream* stream, const char* name, std::vector<uint64_t>* ids);
+    bool ReadBack(DBStream* stream, uint64_t id);
+
+    static std::vector<unsigned char> MakeData(size_t size, unsigned int seed);
+    static uint64_t Checksum(uint64_t hash, const unsigned char* data, size_t size);
+
     //
     // Implementation of DBStreamReader interface
     //
@@ -280,6 +422,37 @@ void DBStreamClient::Read()
     //mDBStream->ReadById(2, false, 13, false);
 }
 
+void DBStreamClient::ReadCursor()
+{
+    cout << "Reading all records from '" << mDatabase << "' with cursor..." << endl;
+
+    DBStreamCursor* cursor = mDBStream->OpenCursorById(0, true, 0, true);
+    if(cursor == NULL)
+        return;
+
+    std::vector<unsigned char> buf(65535);
+    StreamHeader hdr;
+    bool found = false;
+
+    while(cursor->Next(&hdr, &found) && found)
+    {
+        size_t read_size = 0;
+        size_t size = 0;
+
+        while(cursor->ReadChunk(buf.data(), buf.size(), &size) && size > 0)
+            read_size += size;
+
+        cout << __func__ << (Verify(read_size == hdr.size) ? "" : "[ERROR]")
+             << ": id="        << hdr.id
+             << ", descr='"    << hdr.descr << "'"
+             << ", type="      << (int)hdr.type
+             << ", size="      << hdr.size
+             << ", read_size=" << read_size << endl;
+    }
+
+    cursor->Close();
+}
+
 void DBStreamClient::Lookup()
 {
     StreamHeader hdr;
@@ -334,96 +507,1834 @@ void DBStreamClient::Describe()
     mDBStream->Describe();
 }
 
-bool DBStreamClient::OnRead(const StreamHeader* hdr,
-                            unsigned char* data, size_t size, 
-                            int reading_state)
+DBStream* DBStreamClient::CreateStream(const DBStreamOptions& options, DBStreamReader* reader,
+                                       const char* database)
 {
-    static CStopWatch st(string(__func__) + ": ", true);
-    static size_t read_size = 0;
+    CreateDBStreamExPtr pfCreateDBStreamEx =
+            (CreateDBStreamExPtr)dlsym(mMySqlLib, CREATE_DB_STREAM_EX_FUNC_NAME);
 
-    switch(reading_state)
+    if(pfCreateDBStreamEx == nullptr)
+    {
+        cout << "ERROR: dlsym() failed because of " << dlerror() << endl;
+        return NULL;
+    }
+
+    return (*pfCreateDBStreamEx)(mHost.c_str(), mUser.c_str(), mPasswd.c_str(),
+                                 (database != NULL ? database : mDatabase.c_str()),
+                                 (reader != NULL ? reader : this), this, &options);
+}
+
+// Pseudo-random data, the same for the same seed
+std::vector<unsigned char> DBStreamClient::MakeData(size_t size, unsigned int seed)
+{
+    std::vector<unsigned char> data(size);
+    uint32_t x = seed * 2654435761u + 1;
+
+    for(size_t i = 0; i < size; i++)
+    {
+        x = x * 1103515245 + 12345;
+        data[i] = (unsigned char)(x >> 16);
+    }
+
+    return data;
+}
+
+// FNV-1a, Checksum(0, NULL, 0) is the initial value
+uint64_t DBStreamClient::Checksum(uint64_t hash, const unsigned char* data, size_t size)
+{
+    if(data == NULL)
+        return 14695981039346656037ull;
+
+    for(size_t i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * 1099511628211ull;
+
+    return hash;
+}
+
+uint64_t DBStreamClient::WriteData(DBStream* stream, const char* descr,
+                                   const std::vector<unsigned char>& data, uint64_t timestamp)
+{
+    if(timestamp == 0)
+    {
+        struct timeval  tv;
+        gettimeofday(&tv, NULL);
+        timestamp = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    }
+
+    StreamHeader hdr;
+    hdr.descr = descr;
+    hdr.type = (data.size() < 1024 ? 0 : data.size() < 1024*64 ? 1 : 2);
+    hdr.timestamp = timestamp;
+    hdr.size = data.size();
+
+    if(!Verify(stream->Write(&hdr, data.data())))
     {
-    case DB_STREAM_READ_BEGIN:
-        st.Start();
-        read_size = 0;
         cout << __func__
-             << ": id="     << hdr->id
-             << ", descr='" << hdr->descr << "'"
-             << ", type="   << (int)hdr->type
-             << ", size="   << hdr->size << " ..." << endl;
-        break;
+             << ": descr='" << hdr.descr << "'"
+             << ", size=" << hdr.size << " [ERROR]" << endl;
+        return 0;
+    }
 
-    case DB_STREAM_READ_DATA:
-        read_size += size;
-        break;
+    std::lock_guard<std::mutex> lock(mChecksumsMutex);
+    mChecksums[hdr.id] = Checksum(Checksum(0, NULL, 0), data.data(), data.size());
+    return hdr.id;
+}
 
-    case DB_STREAM_READ_END:
-        cout << __func__ << (read_size != hdr->size ? "[ERROR]" : "")
-             << ": id="        << hdr->id
-             << ", descr='"    << hdr->descr << "'"
-             << ", type="      << (int)hdr->type
-             << ", size="      << hdr->size
-             << ", read_size=" << read_size << endl;
-        read_size = 0;
-        st.Stop();
-        break;
+// Write the streams of all sizes around the chunk boundaries
+bool DBStreamClient::WriteTestData(DBStream* stream, const char* name, std::vector<uint64_t>* ids)
+{
+    const size_t sizes[] = { 0, 1, 1000, 65534, 65535, 65536, 200000, 1024*1024 + 7 };
+
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        string descr = string(name) + "_" + to_string(sizes[i]);
+        uint64_t id = WriteData(stream, descr.c_str(), MakeData(sizes[i], i));
+        if(id == 0)
+            return false;
+
+        ids->push_back(id);
     }
-     
+
     return true;
 }
 
-int main(int argc, const char** argv)
+// Read the stream back with cursor and verify its data
+bool DBStreamClient::ReadBack(DBStream* stream, uint64_t id)
 {
-    cout << boolalpha;
+    DBStreamCursor* cursor = stream->OpenCursorById(id, true, id, true);
+    if(!Verify(cursor != NULL))
+        return false;
 
-    // Get the canonicalized absolute pathname
-    char libname[PATH_MAX]{};
-    realpath(argv[0], libname);
-    const char* dir = dirname(libname);
-    libname[strlen(dir)] = '\0';
-    strcat(libname, "/libmysqlstream.so");
+    std::vector<unsigned char> buf(65535);
+    StreamHeader hdr;
+    bool found = false;
+    bool ok = cursor->Next(&hdr, &found) && found;
 
-    const char* DB_HOST = "tcp://localhost:3309";
-    const char* DB_NAME = "StreamDB";
-    const char* DB_USER = "Loader";
-    const char* DB_PASS = "Loader";
+    size_t read_size = 0;
+    size_t size = 0;
+    uint64_t hash = Checksum(0, NULL, 0);
 
-    DBStreamClient dbstreamClient(libname, DB_HOST, DB_USER, DB_PASS, DB_NAME);
-    if(!dbstreamClient.IsValid())
-        return 1;
-    
-    dbstreamClient.Describe();
-    dbstreamClient.Lookup();
+    while(ok && cursor->ReadChunk(buf.data(), buf.size(), &size) && size > 0)
+    {
+        read_size += size;
+        hash = Checksum(hash, buf.data(), size);
+    }
 
-    // Write all files from the current user Download directory 
-    struct passwd* pwd = getpwuid(getuid());
-    string writeDir(pwd ? pwd->pw_dir : ".");
-    writeDir += "/Downloads";
-    if(access(writeDir.c_str(), F_OK | R_OK) == 0)
     {
-        dbstreamClient.WriteDir(writeDir.c_str());
+        std::lock_guard<std::mutex> lock(mChecksumsMutex);
+        ok = ok && read_size == hdr.size && mChecksums[id] == hash;
     }
-    else
+
+    cout << __func__ << (Verify(ok) ? "" : " [ERROR]")
+         << ": id="        << id
+         << ", found="     << found
+         << ", read_size=" << read_size << endl;
+
+    cursor->Close();
+    return ok;
+}
+
+void DBStreamClient::TestReadModes()
+{
+    cout << endl << "Testing read modes..." << endl;
+
+    std::vector<uint64_t> ids;
+    if(!WriteTestData(mDBStream, "read_mode", &ids))
+        return;
+
+    const int modes[] = { DB_STREAM_READ_MODE_CHUNK, DB_STREAM_READ_MODE_STREAM, DB_STREAM_READ_MODE_BATCH };
+    const char* names[] = { "chunk", "stream", "batch" };
+
+    for(size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
     {
-        cout << "The directory \"" << writeDir << "\" doesn't exist or isn't readable" << endl;
+        DBStreamOptions options;
+        options.read_mode = modes[i];
+
+        // Every mode reads the same data, OnRead() verifies it
+        DBStream* stream = CreateStream(options);
+        if(!Verify(stream != NULL))
+        {
+            cout << __func__ << ": " << names[i] << " [ERROR]" << endl;
+            continue;
+        }
+
+        {
+            CStopWatch t(string(__func__) + ": " + names[i] + ": ");
+            Verify(stream->ReadById(ids.front(), true, ids.back(), true));
+        }
+
+        stream->Destroy();
+
+        // Stop at the first data chunk, the rest of the query results are
+        // dropped and the stream has to work on after
+        StreamCounter counter(true, 1);
+        stream = CreateStream(options, &counter);
+        if(!Verify(stream != NULL))
+            continue;
+
+        bool found = false;
+        bool ok = stream->ReadById(ids[2], true, ids.back(), true) && counter.mCount == 1 &&
+                  stream->LookupById(ids.back(), &found) && found;
+
+        cout << __func__ << (Verify(ok) ? "" : " [ERROR]")
+             << ": " << names[i] << ": stopped after " << counter.mCount << " stream(s)" << endl;
+
+        stream->Destroy();
     }
 
-    // Write largeDataFile - expected to be the current directory
-    string largeFile("./largeDataFile");
-    if(access(largeFile.c_str(), F_OK | R_OK) == 0)
+    mDBStream->DeleteById(ids.front(), true, ids.back(), true);
+}
+
+void DBStreamClient::TestUnbuffered()
+{
+    cout << endl << "Testing unbuffered reads..." << endl;
+
+    std::vector<uint64_t> ids;
+    if(!WriteTestData(mDBStream, "unbuffered", &ids))
+        return;
+
+    const int modes[] = { DB_STREAM_READ_MODE_STREAM, DB_STREAM_READ_MODE_BATCH };
+    const char* names[] = { "stream", "batch" };
+
+    for(size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
     {
-        dbstreamClient.WriteFileLarge(largeFile.c_str());
+        DBStreamOptions options;
+        options.read_mode = modes[i];
+        options.read_unbuffered = true;
+
+        DBStream* stream = CreateStream(options);
+        if(!Verify(stream != NULL))
+        {
+            cout << __func__ << ": " << names[i] << " [ERROR]" << endl;
+            continue;
+        }
+
+        {
+            CStopWatch t(string(__func__) + ": " + names[i] + ": ");
+            Verify(stream->ReadById(ids.front(), true, ids.back(), true));
+        }
+
+        stream->Destroy();
+
+        // Stop in the middle of the largest stream. The rows not yet fetched
+        // are still on the way, and the next query has to work anyway.
+        StreamCounter counter(true, 2);
+        stream = CreateStream(options, &counter);
+        if(!Verify(stream != NULL))
+            continue;
+
+        bool ok = stream->ReadById(ids.back(), true, ids.back(), true) && counter.mCount == 1;
+
+        counter.Reset();
+        ok = ok && stream->ReadById(ids.front(), true, ids.back(), true) &&
+             counter.mCount == ids.size() && !counter.mError;
+
+        cout << __func__ << (Verify(ok) ? "" : " [ERROR]")
+             << ": " << names[i] << ": read after stop=" << counter.mCount << endl;
+
+        stream->Destroy();
     }
-    else
+
+    mDBStream->DeleteById(ids.front(), true, ids.back(), true);
+}
+
+void DBStreamClient::TestWriteBatches()
+{
+    cout << endl << "Testing multi-row INSERTs..." << endl;
+
+    // Four chunks of the default size per INSERT, the streams just under,
+    // at and over the multiples of it end with a partial INSERT or none
+    const size_t CHUNK_SIZE = 65535;
+    DBStreamOptions options;
+    options.write_batch_size = 4 * CHUNK_SIZE;
+
+    DBStream* stream = CreateStream(options);
+    if(!Verify(stream != NULL))
     {
-        cout << "The file \"" << largeFile << "\" doesn't exist or isn't readable" << endl;
+        cout << __func__ << " [ERROR]" << endl;
+        return;
     }
 
-    dbstreamClient.Read();
-    dbstreamClient.Lookup();
+    const size_t sizes[] = { 4 * CHUNK_SIZE - 1, 4 * CHUNK_SIZE, 4 * CHUNK_SIZE + 1,
+                             8 * CHUNK_SIZE, 8 * CHUNK_SIZE + 1, 12 * CHUNK_SIZE + CHUNK_SIZE / 2 };
+    std::vector<uint64_t> ids;
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        string descr = "write_batch_" + to_string(sizes[i]);
+        uint64_t id = WriteData(stream, descr.c_str(), MakeData(sizes[i], i));
+        if(id > 0)
+            ids.push_back(id);
+    }
 
-    dbstreamClient.Delete();
-    dbstreamClient.Lookup();
+    if(!ids.empty())
+    {
+        Verify(mDBStream->ReadById(ids.front(), true, ids.back(), true));
+        mDBStream->DeleteById(ids.front(), true, ids.back(), true);
+    }
+
+    stream->Destroy();
+
+    // A row per INSERT against as many as fit into max_allowed_packet
+    std::vector<unsigned char> data = MakeData(4*1024*1024, 3);
+    const size_t batch_sizes[] = { 1, 64*1024*1024 };
+
+    for(size_t batch_size : batch_sizes)
+    {
+        options.write_batch_size = batch_size;
+        stream = CreateStream(options);
+        if(!Verify(stream != NULL))
+            continue;
+
+        uint64_t id = 0;
+        {
+            CStopWatch t(string(__func__) + ": write_batch_size=" + to_string(batch_size) + ": ");
+            id = WriteData(stream, "write_batch_4MB", data);
+        }
+
+        if(id > 0)
+        {
+            Verify(mDBStream->ReadById(id, true, id, true));
+            mDBStream->DeleteById(id, true, id, true);
+        }
+
+        stream->Destroy();
+    }
+}
+
+void DBStreamClient::TestChunkSizes()
+{
+    cout << endl << "Testing chunk sizes..." << endl;
+
+    // The chunk size is kept with every stream, so the streams written
+    // with one chunk size read back with any other. The largest one is
+    // capped by the data column type of the existing table.
+    const size_t chunk_sizes[] = { 1000, 65535, 1024*1024 };
+    const size_t sizes[] = { 0, 2500, 200000 };
+    std::vector<uint64_t> ids;
+
+    for(size_t chunk_size : chunk_sizes)
+    {
+        DBStreamOptions options;
+        options.chunk_size = chunk_size;
+
+        DBStream* stream = CreateStream(options);
+        if(!Verify(stream != NULL))
+            continue;
+
+        for(size_t size : sizes)
+        {
+            string descr = "chunk_size_" + to_string(chunk_size) + "_" + to_string(size);
+            uint64_t id = WriteData(stream, descr.c_str(), MakeData(size, chunk_size + size));
+            if(id > 0)
+                ids.push_back(id);
+        }
+
+        stream->Destroy();
+    }
+
+    for(size_t chunk_size : chunk_sizes)
+    {
+        DBStreamOptions options;
+        options.chunk_size = chunk_size;
+
+        DBStream* stream = CreateStream(options);
+        if(!Verify(stream != NULL) || ids.empty())
+            continue;
+
+        cout << "Reading with chunk size " << chunk_size << "..." << endl;
+        Verify(stream->ReadById(ids.front(), true, ids.back(), true));
+
+        stream->Destroy();
+    }
+
+    if(!ids.empty())
+        mDBStream->DeleteById(ids.front(), true, ids.back(), true);
+}
+
+void DBStreamClient::TestPool()
+{
+    cout << endl << "Testing pool..." << endl;
+
+    CreateDBStreamPoolPtr pfCreateDBStreamPool =
+            (CreateDBStreamPoolPtr)dlsym(mMySqlLib, CREATE_DB_STREAM_POOL_FUNC_NAME);
+
+    if(pfCreateDBStreamPool == nullptr)
+    {
+        cout << "ERROR: dlsym() failed because of " << dlerror() << endl;
+        Verify(false);
+        return;
+    }
+
+    const size_t POOL_SIZE = 4;
+    DBStreamOptions options;
+    DBStreamPool* pool = (*pfCreateDBStreamPool)(mHost.c_str(), mUser.c_str(), mPasswd.c_str(),
+                                                 mDatabase.c_str(), this, this, &options, POOL_SIZE);
+    if(!Verify(pool != NULL))
+    {
+        cout << __func__ << " [ERROR]" << endl;
+        return;
+    }
+
+    // More threads than streams, so some wait in Acquire(). Every thread
+    // writes its streams, and reads them back with its own reader.
+    std::vector<std::vector<uint64_t>> ids(POOL_SIZE * 2);
+    std::vector<std::thread> threads;
+    for(size_t i = 0; i < ids.size(); i++)
+    {
+        threads.emplace_back([this, pool, &ids, i] {
+            DBStream* stream = pool->Acquire(NULL);
+            WriteTestData(stream, ("pool_" + to_string(i)).c_str(), &ids[i]);
+            pool->Release(stream);
+
+            StreamCounter counter(false);
+            stream = pool->Acquire(&counter);
+            for(uint64_t id : ids[i])
+                stream->ReadById(id, true, id, true);
+            pool->Release(stream);
+
+            cout << __func__ << (Verify(counter.mCount == ids[i].size() && !counter.mError) ? "" : " [ERROR]")
+                 << ": thread " << i << ": read=" << counter.mCount << endl;
+        });
+    }
+
+    for(std::thread& thread : threads)
+        thread.join();
+
+    // The threads wrote at the same time, so their ids are interleaved
+    uint64_t id_first = UINT64_MAX;
+    uint64_t id_last = 0;
+    for(const std::vector<uint64_t>& thread_ids : ids)
+    {
+        for(uint64_t id : thread_ids)
+        {
+            id_first = std::min(id_first, id);
+            id_last = std::max(id_last, id);
+        }
+    }
+
+    DBStream* stream = pool->Acquire(NULL);
+    if(id_last > 0)
+        stream->DeleteById(id_first, true, id_last, true);
+    pool->Release(stream);
+
+    pool->Destroy();
+}
+
+void DBStreamClient::TestSnapshot()
+{
+    cout << endl << "Testing write and delete while reading..." << endl;
+
+    // Hold the reading in OnRead() until the other thread is done, or 2s
+    struct HoldingReader : public DBStreamReader
+    {
+        virtual bool OnRead(const StreamHeader* hdr,
+                            unsigned char* data, size_t size,
+                            int reading_state)
+        {
+            if(reading_state == DB_STREAM_READ_DATA && !mHeld)
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mHeld = true;
+                mCond.notify_all();
+                mDoneWhileReading = mCond.wait_for(lock, std::chrono::milliseconds(2000), [this] { return mDone; });
+            }
+            return true;
+        }
+
+        std::mutex mMutex;
+        std::condition_variable mCond;
+        bool mHeld = false;
+        bool mDone = false;
+        bool mDoneWhileReading = false;
+    };
+
+    // The consistent snapshot doesn't block the writes and deletes,
+    // the table locks do until the reading is over
+    const int modes[] = { DB_STREAM_LOCK_SNAPSHOT, DB_STREAM_LOCK_TABLES };
+    const char* names[] = { "snapshot", "tables" };
+
+    for(size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+    {
+        DBStreamOptions options;
+        options.lock_mode = modes[i];
+
+        HoldingReader holder;
+        DBStream* reader = CreateStream(options, &holder);
+        DBStream* writer = CreateStream(options);
+        if(!Verify(reader != NULL && writer != NULL))
+        {
+            cout << __func__ << ": " << names[i] << " [ERROR]" << endl;
+            if(reader != NULL)
+                reader->Destroy();
+            if(writer != NULL)
+                writer->Destroy();
+            continue;
+        }
+
+        uint64_t id_read = WriteData(writer, "snapshot_read", MakeData(1024*1024, 6));
+        uint64_t id_deleted = WriteData(writer, "snapshot_deleted", MakeData(1000, 7));
+        uint64_t id_written = 0;
+
+        std::thread thread([reader, id_read] {
+            reader->ReadById(id_read, true, id_read, true);
+        });
+
+        {
+            std::unique_lock<std::mutex> lock(holder.mMutex);
+            holder.mCond.wait_for(lock, std::chrono::milliseconds(2000), [&holder] { return holder.mHeld; });
+        }
+
+        id_written = WriteData(writer, "snapshot_written", MakeData(1000, 8));
+        writer->DeleteById(id_deleted, true, id_deleted, true);
+
+        {
+            std::lock_guard<std::mutex> lock(holder.mMutex);
+            holder.mDone = true;
+            holder.mCond.notify_all();
+        }
+
+        thread.join();
+
+        bool found = true;
+        writer->LookupById(id_deleted, &found);
+        bool ok = (id_written > 0 && !found && holder.mHeld &&
+                   holder.mDoneWhileReading == (modes[i] == DB_STREAM_LOCK_SNAPSHOT));
+
+        cout << __func__ << (Verify(ok) ? "" : " [ERROR]")
+             << ": " << names[i] << ": written and deleted while reading=" << holder.mDoneWhileReading << endl;
+
+        writer->DeleteById(id_read, true, id_written, true);
+
+        reader->Destroy();
+        writer->Destroy();
+    }
+}
+
+void DBStreamClient::TestWriter()
+{
+    cout << endl << "Testing writer..." << endl;
+
+    CreateDBStreamWriterPtr pfCreateDBStreamWriter =
+            (CreateDBStreamWriterPtr)dlsym(mMySqlLib, CREATE_DB_STREAM_WRITER_FUNC_NAME);
+
+    if(pfCreateDBStreamWriter == nullptr)
+    {
+        cout << "ERROR: dlsym() failed because of " << dlerror() << endl;
+        Verify(false);
+        return;
+    }
+
+    const size_t QUEUE_SIZE = 16;
+    DBStreamOptions options;
+    DBStreamWriter* writer = (*pfCreateDBStreamWriter)(mHost.c_str(), mUser.c_str(), mPasswd.c_str(),
+                                                       mDatabase.c_str(), this, &options, QUEUE_SIZE);
+    if(!Verify(writer != NULL))
+    {
+        cout << __func__ << " [ERROR]" << endl;
+        return;
+    }
+
+    // Queue more streams than fit, the ones that don't fit get id 0.
+    // The caller data can go right away, the writer has its copy.
+    std::vector<uint64_t> checksums;
+    std::vector<std::future<uint64_t>> futures;
+    for(size_t i = 0; i < QUEUE_SIZE * 3; i++)
+    {
+        std::vector<unsigned char> data = MakeData(i * 1000, i);
+        checksums.push_back(Checksum(Checksum(0, NULL, 0), data.data(), data.size()));
+
+        string descr = "writer_" + to_string(i);
+        StreamHeader hdr;
+        hdr.descr = descr.c_str();
+        hdr.type = 0;
+        hdr.timestamp = i + 1;
+        hdr.size = data.size();
+
+        futures.push_back(writer->Write(&hdr, data.data()));
+
+        // Destroy() writes the rest of the queue
+        if(i == QUEUE_SIZE * 2 - 1)
+            writer->Flush();
+    }
+
+    writer->Destroy();
+
+    std::vector<uint64_t> ids;
+    for(size_t i = 0; i < futures.size(); i++)
+    {
+        uint64_t id = futures[i].get();
+        if(id == 0)
+        {
+            // The ones queued after Flush() all fit
+            Verify(i < QUEUE_SIZE * 2);
+            continue;
+        }
+
+        mChecksums[id] = checksums[i];
+        ids.push_back(id);
+    }
+
+    cout << __func__ << ": written=" << ids.size() << " of " << futures.size() << endl;
+
+    if(!ids.empty())
+    {
+        Verify(mDBStream->ReadById(ids.front(), true, ids.back(), true));
+        mDBStream->DeleteById(ids.front(), true, ids.back(), true);
+    }
+}
+
+void DBStreamClient::TestWriteBatch()
+{
+    cout << endl << "Testing write batch..." << endl;
+
+    // Three streams per transaction, the third one fails
+    DBStreamOptions options;
+    options.group_commit_size = 3;
+
+    DBStream* stream = CreateStream(options);
+    if(!Verify(stream != NULL))
+    {
+        cout << __func__ << " [ERROR]" << endl;
+        return;
+    }
+
+    const size_t COUNT = 10;
+    const size_t BAD = 7;
+    std::vector<std::vector<unsigned char>> data(COUNT);
+    std::vector<std::string> descrs(COUNT);
+    std::vector<StreamHeader> hdrs(COUNT);
+    std::vector<const unsigned char*> ptrs(COUNT);
+
+    for(size_t i = 0; i < COUNT; i++)
+    {
+        data[i] = MakeData(i * 10000 + 1, i);
+        descrs[i] = "write_batch_" + to_string(i);
+
+        hdrs[i].id = 0;
+        hdrs[i].descr = descrs[i].c_str();
+        hdrs[i].type = 1;
+        hdrs[i].timestamp = i + 1;
+        hdrs[i].size = data[i].size();
+        ptrs[i] = (i == BAD ? NULL : data[i].data());
+    }
+
+    bool ok = false;
+    {
+        CStopWatch t(string(__func__) + ": ");
+        ok = stream->WriteBatch(hdrs.data(), ptrs.data(), COUNT);
+    }
+
+    // The transactions before the failed one are committed,
+    // the rest of the streams are not written
+    size_t committed = BAD / options.group_commit_size * options.group_commit_size;
+    ok = !ok;
+
+    for(size_t i = 0; i < COUNT; i++)
+    {
+        bool found = false;
+        if(hdrs[i].id > 0)
+        {
+            mChecksums[hdrs[i].id] = Checksum(Checksum(0, NULL, 0), data[i].data(), data[i].size());
+            stream->LookupById(hdrs[i].id, &found);
+        }
+
+        ok = ok && (i < committed ? found : hdrs[i].id == 0);
+    }
+
+    cout << __func__ << (Verify(ok) ? "" : " [ERROR]")
+         << ": committed=" << committed << " of " << COUNT << endl;
+
+    if(hdrs.front().id > 0 && hdrs[committed - 1].id > 0)
+    {
+        Verify(stream->ReadById(hdrs.front().id, true, hdrs[committed - 1].id, true));
+        stream->DeleteById(hdrs.front().id, true, hdrs[committed - 1].id, true);
+    }
+
+    stream->Destroy();
+}
+
+void DBStreamClient::TestFollow()
+{
+    cout << endl << "Testing follow..." << endl;
+
+    // Poll only every 10s, so the streams are in time
+    // only if the follower is woken by the commits
+    DBStreamOptions options;
+    options.follow_min_wait = 10000;
+    options.follow_max_wait = 10000;
+
+    StreamCounter counter(true);
+    DBStream* follower = CreateStream(options, &counter);
+    if(!Verify(follower != NULL))
+    {
+        cout << __func__ << " [ERROR]" << endl;
+        return;
+    }
+
+    // Follow the streams after this one
+    uint64_t id_start = WriteData(mDBStream, "follow_start", MakeData(10, 0));
+
+    bool followed = false;
+    std::thread thread([follower, id_start, &followed] {
+        followed = follower->Follow(id_start, false);
+    });
+
+    // Let the follower wait first
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint64_t> ids;
+    WriteTestData(mDBStream, "follow", &ids);
+
+    // Two writers at once commit their streams out of id order,
+    // the follower has to read them in id order anyway
+    const size_t WRITERS = 2;
+    std::vector<std::thread> writers;
+    for(size_t i = 0; i < WRITERS; i++)
+    {
+        writers.emplace_back([this] {
+            DBStream* writer = CreateStream(DBStreamOptions());
+            if(writer == NULL)
+                return;
+            for(size_t j = 0; j < 10; j++)
+                WriteData(writer, "follow_concurrent", MakeData((j % 3) * 100000, j), 0);
+            writer->Destroy();
+        });
+    }
+
+    for(std::thread& writer : writers)
+        writer.join();
+
+    size_t expected = ids.size() + WRITERS * 10;
+
+    size_t count = counter.Wait(expected, 5000);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    follower->StopFollow();
+    thread.join();
+
+    cout << __func__ << (Verify(followed && count == expected && !counter.mError && elapsed.count() < 5000) ? "" : " [ERROR]")
+         << ": written=" << expected
+         << ", followed=" << count
+         << ", in " << elapsed.count() << " ms" << endl;
+
+    StreamHeader hdr;
+    hdr.id = 0;
+    mDBStream->GetLast(&hdr);
+    mDBStream->DeleteById(id_start, true, hdr.id, true);
+
+    follower->Destroy();
+}
+
+void DBStreamClient::TestCursor()
+{
+    cout << endl << "Testing cursor..." << endl;
+
+    // Small chunks, so the streams have many of them
+    DBStreamOptions options;
+    options.chunk_size = 1000;
+
+    DBStream* stream = CreateStream(options);
+    if(!Verify(stream != NULL))
+    {
+        cout << __func__ << " [ERROR]" << endl;
+        return;
+    }
+
+    std::vector<uint64_t> ids;
+    if(WriteTestData(stream, "cursor", &ids))
+    {
+        for(uint64_t id : ids)
+            ReadBack(stream, id);
+
+        // Read just a bit of every other stream and skip the rest, Next()
+        // has to move to the next stream all the same
+        DBStreamCursor* cursor = stream->OpenCursorById(ids.front(), true, ids.back(), true);
+        if(Verify(cursor != NULL))
+        {
+            unsigned char buf[100];
+            StreamHeader hdr;
+            bool found = false;
+            size_t count = 0;
+            bool ok = true;
+
+            while(cursor->Next(&hdr, &found) && found)
+            {
+                ok = ok && hdr.id == ids[count];
+
+                size_t size = 0;
+                if(count++ % 2 == 0)
+                    ok = ok && cursor->ReadChunk(buf, sizeof(buf), &size) && size == std::min(sizeof(buf), (size_t)hdr.size);
+            }
+
+            cout << __func__ << (Verify(ok && count == ids.size()) ? "" : " [ERROR]")
+                 << ": streams=" << count << endl;
+
+            cursor->Close();
+        }
+
+        // The stream works on after the cursor
+        bool found = false;
+        Verify(stream->LookupById(ids.back(), &found) && found);
+    }
+
+    if(!ids.empty())
+        stream->DeleteById(ids.front(), true, ids.back(), true);
+
+    stream->Destroy();
+}
+
+void DBStreamClient::TestParallelRead()
+{
+    cout << endl << "Testing parallel read..." << endl;
+
+    CreateDBStreamPoolPtr pfCreateDBStreamPool =
+            (CreateDBStreamPoolPtr)dlsym(mMySqlLib, CREATE_DB_STREAM_POOL_FUNC_NAME);
+
+    if(pfCreateDBStreamPool == nullptr)
+    {
+        cout << "ERROR: dlsym() failed because of " << dlerror() << endl;
+        Verify(false);
+        return;
+    }
+
+    const uint64_t TIMESTAMP = 1000000;
+    const size_t COUNT = 40;
+    std::vector<uint64_t> ids;
+    for(size_t i = 0; i < COUNT; i++)
+    {
+        string descr = "parallel_" + to_string(i);
+        uint64_t id = WriteData(mDBStream, descr.c_str(), MakeData(i * 5000, i), TIMESTAMP + i);
+        if(id > 0)
+            ids.push_back(id);
+    }
+
+    // Small slices and buffer, so the threads wait for each other
+    DBStreamOptions options;
+    options.parallel_slice_size = 3;
+    options.parallel_buffer_size = 100000;
+
+    for(int ordered = 1; ordered >= 0 && !ids.empty(); ordered--)
+    {
+        for(int byTimestamp = 0; byTimestamp <= 1; byTimestamp++)
+        {
+            StreamCounter counter(ordered);
+            DBStreamPool* pool = (*pfCreateDBStreamPool)(mHost.c_str(), mUser.c_str(), mPasswd.c_str(),
+                                                         mDatabase.c_str(), &counter, this, &options, 4);
+            if(!Verify(pool != NULL))
+            {
+                cout << __func__ << " [ERROR]" << endl;
+                break;
+            }
+
+            bool ok = false;
+            {
+                CStopWatch t(string(__func__) + (ordered ? ": ordered" : ": unordered") +
+                             (byTimestamp ? " by timestamp: " : " by id: "));
+
+                ok = (byTimestamp ? pool->ReadByTimestamp(TIMESTAMP, true, TIMESTAMP + COUNT, false, ordered) :
+                                    pool->ReadById(ids.front(), true, ids.back(), true, ordered));
+            }
+
+            cout << __func__ << (Verify(ok && counter.mCount == ids.size() && !counter.mError) ? "" : " [ERROR]")
+                 << ": read=" << counter.mCount
+                 << ", size=" << counter.mSize << endl;
+
+            pool->Destroy();
+        }
+    }
+
+    if(!ids.empty())
+        mDBStream->DeleteById(ids.front(), true, ids.back(), true);
+}
+
+void DBStreamClient::TestTimestamps()
+{
+    cout << endl << "Testing timestamps..." << endl;
+
+    const uint64_t TIMESTAMP = 2000000;
+    const size_t COUNT = 10;
+    std::vector<uint64_t> ids;
+    for(size_t i = 0; i < COUNT; i++)
+    {
+        string descr = "timestamp_" + to_string(i);
+        ids.push_back(WriteData(mDBStream, descr.c_str(), MakeData(i * 1000, i), TIMESTAMP + i));
+    }
+
+    StreamCounter counter(true);
+    DBStream* stream = CreateStream(DBStreamOptions(), &counter);
+    if(!Verify(stream != NULL))
+    {
+        cout << __func__ << " [ERROR]" << endl;
+        return;
+    }
+
+    bool found = false;
+    bool ok = stream->LookupByTimestamp(TIMESTAMP + 5, &found) && found;
+
+    stream->LookupByTimestamp(TIMESTAMP + COUNT, &found);
+    ok = ok && !found;
+
+    // The first inclusive and the last exclusive
+    ok = ok && stream->ReadByTimestamp(TIMESTAMP + 2, true, TIMESTAMP + 5, false) &&
+         counter.mCount == 3 && counter.mLastId == ids[4];
+
+    cout << __func__ << (Verify(ok) ? "" : " [ERROR]")
+         << ": read=" << counter.mCount << endl;
+
+    ok = stream->DeleteByTimestamp(TIMESTAMP, true, TIMESTAMP + 4, true);
+
+    stream->LookupByTimestamp(TIMESTAMP + 2, &found);
+    ok = ok && !found;
+
+    stream->LookupById(ids[5], &found);
+    ok = ok && found;
+
+    cout << __func__ << (Verify(ok) ? "" : " [ERROR]")
+         << ": deleted by timestamp" << endl;
+
+    stream->DeleteByTimestamp(TIMESTAMP, true, TIMESTAMP + COUNT, false);
+    stream->Destroy();
+}
+
+// The database is expected to have no tables on the first run,
+// so they are created partitioned
+void DBStreamClient::TestRetention(const char* database)
+{
+    cout << endl << "Testing retention with '" << database << "'..." << endl;
+
+    DBStreamOptions options;
+    options.partition_size = 10;
+
+    StreamCounter counter(true);
+    DBStream* stream = CreateStream(options, &counter, database);
+    if(stream == NULL)
+    {
+        cout << "The database \"" << database << "\" doesn't exist or isn't accessible" << endl;
+        return;
+    }
+
+    stream->DeleteAll();
+
+    const uint64_t TIMESTAMP = 3000000;
+    const size_t COUNT = 35;
+    std::vector<uint64_t> ids;
+    for(size_t i = 0; i < COUNT; i++)
+    {
+        string descr = "retention_" + to_string(i);
+        uint64_t id = WriteData(stream, descr.c_str(), MakeData(i * 3000, i), TIMESTAMP + i);
+        if(id > 0)
+            ids.push_back(id);
+    }
+
+    // Only the partitions with all streams expired are dropped
+    {
+        CStopWatch t(string(__func__) + ": DropExpired: ");
+        Verify(stream->DropExpired(TIMESTAMP + 20));
+    }
+
+    // The partition of the first stream has all streams expired, the
+    // ones after are dropped as long as they do, and the streams not
+    // yet expired all stay
+    bool ok = (ids.size() == COUNT);
+    bool dropped = true;
+    size_t kept = 0;
+    for(size_t i = 0; i < ids.size(); i++)
+    {
+        bool found = false;
+        stream->LookupById(ids[i], &found);
+
+        ok = ok && (i > 0 || !found) && (i < 20 || found) && (dropped || found);
+        dropped = !found;
+        kept += found;
+    }
+
+    Verify(stream->ReadById(0, true, 0, true));
+
+    cout << __func__ << (Verify(ok && counter.mCount == kept && !counter.mError) ? "" : " [ERROR]")
+         << ": kept=" << kept << " of " << ids.size() << endl;
+
+    stream->DeleteAll();
+    stream->Destroy();
+
+    // The ids of the other database are no good for the checksums
+    for(uint64_t id : ids)
+        mChecksums.erase(id);
+}
+
+void DBStreamClient::TestDeleteAll()
+{
+    cout << endl << "Testing delete all..." << endl;
+
+    std::vector<uint64_t> ids;
+    WriteTestData(mDBStream, "delete_all", &ids);
+
+    {
+        CStopWatch t(string(__func__) + ": DeleteAll: ");
+        Verify(mDBStream->DeleteAll());
+    }
+
+    // The ids go on after DeleteAll(), and start from 1 again after DeleteAll(true)
+    bool found = true;
+    mDBStream->LookupById(ids.back(), &found);
+
+    uint64_t id = WriteData(mDBStream, "delete_all_keep_id", MakeData(1000, 0));
+    cout << __func__ << (Verify(!found && !ids.empty() && id > ids.back()) ? "" : " [ERROR]")
+         << ": id after DeleteAll()=" << id << endl;
+
+    {
+        CStopWatch t(string(__func__) + ": DeleteAll(reset_id): ");
+        Verify(mDBStream->DeleteAll(true));
+    }
+
+    // The checksums of the old ids are no good anymore
+    mChecksums.clear();
+
+    id = WriteData(mDBStream, "delete_all_reset_id", MakeData(1000, 0));
+    cout << __func__ << (Verify(id == 1) ? "" : " [ERROR]")
+         << ": id after DeleteAll(true)=" << id << endl;
+
+    Verify(mDBStream->ReadById(0, true, 0, true));
+    mDBStream->DeleteAll();
+}
+
+void DBStreamClient::TestPurge()
+{
+    cout << endl << "Testing purge..." << endl;
+
+    // Report the progress, and stop after max_batches batches
+    struct PurgeProgress : public DBStreamPurgeProgress
+    {
+        PurgeProgress(size_t max_batches) : mMaxBatches(max_batches) {}
+
+        virtual bool OnPurge(uint64_t deleted, uint64_t id_last)
+        {
+            cout << "OnPurge: deleted=" << deleted << ", id_last=" << id_last << endl;
+            mDeleted = deleted;
+            return ++mBatches < mMaxBatches;
+        }
+
+        size_t mMaxBatches = 0;
+        size_t mBatches = 0;
+        uint64_t mDeleted = 0;
+    };
+
+    DBStreamOptions options;
+    options.purge_batch_size = 4;
+    options.purge_rate = 20;
+
+    DBStream* stream = CreateStream(options);
+    if(!Verify(stream != NULL))
+    {
+        cout << __func__ << " [ERROR]" << endl;
+        return;
+    }
+
+    const uint64_t TIMESTAMP = 4000000;
+    const size_t COUNT = 20;
+    std::vector<uint64_t> ids;
+    for(size_t i = 0; i < COUNT; i++)
+    {
+        string descr = "purge_" + to_string(i);
+        uint64_t id = WriteData(stream, descr.c_str(), MakeData(i * 1000, i), TIMESTAMP + i);
+        if(id > 0)
+            ids.push_back(id);
+    }
+
+    if(ids.size() == COUNT)
+    {
+        // Stopped after the first batch
+        PurgeProgress stopped(1);
+        bool ok = stream->PurgeById(ids.front(), true, ids.back(), true, &stopped) &&
+                  stopped.mDeleted == options.purge_batch_size;
+
+        bool found = false;
+        stream->LookupById(ids[options.purge_batch_size - 1], &found);
+        ok = ok && !found;
+
+        stream->LookupById(ids[options.purge_batch_size], &found);
+        ok = ok && found;
+
+        cout << __func__ << (Verify(ok) ? "" : " [ERROR]")
+             << ": stopped after " << stopped.mDeleted << endl;
+
+        // The rest by timestamp, at most purge_rate streams per second
+        auto start = std::chrono::steady_clock::now();
+
+        PurgeProgress progress(COUNT);
+        ok = stream->PurgeByTimestamp(TIMESTAMP, true, TIMESTAMP + COUNT, false, &progress) &&
+             progress.mDeleted == COUNT - options.purge_batch_size;
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        size_t min_elapsed = (COUNT - options.purge_batch_size) * 1000 / options.purge_rate;
+
+        stream->LookupById(ids.back(), &found);
+        ok = ok && !found && (size_t)elapsed.count() >= min_elapsed * 3 / 4;
+
+        cout << __func__ << (Verify(ok) ? "" : " [ERROR]")
+             << ": purged " << progress.mDeleted << " in " << elapsed.count() << " ms" << endl;
+    }
+
+    stream->Destroy();
+}
+
+void DBStreamClient::TestWriteHeader()
+{
+    cout << endl << "Testing write header..." << endl;
+
+    // The description is bound as is, quotes and all
+    const char* descrs[] = { "header", "header_'quoted'", "header_\\\\backslash", "header_\"; DELETE FROM stream; --" };
+    const size_t COUNT = sizeof(descrs) / sizeof(descrs[0]);
+    const uint64_t TIMESTAMP = 5000000;
+
+    for(size_t i = 0; i < COUNT; i++)
+    {
+        uint64_t id = WriteData(mDBStream, descrs[i], MakeData(i * 70000, i), TIMESTAMP + i);
+
+        StreamHeader hdr;
+        hdr.id = 0;
+        mDBStream->GetLast(&hdr);
+
+        bool ok = (id > 0 && hdr.id == id && hdr.descr != NULL && strcmp(hdr.descr, descrs[i]) == 0 &&
+                   hdr.size == i * 70000 && hdr.timestamp == TIMESTAMP + i);
+
+        cout << __func__ << (Verify(ok) ? "" : " [ERROR]")
+             << ": id="     << id
+             << ", descr='" << descrs[i] << "'"
+             << ", last id=" << hdr.id << endl;
+    }
+
+    // The size is stored with the stream record up front, and fixed
+    // up only if the data stream ends short of the header size
+    std::vector<unsigned char> data = MakeData(100000, COUNT);
+    std::stringstream ss(std::string(data.begin(), data.end()));
+
+    StreamHeader hdr;
+    hdr.descr = "header_short";
+    hdr.type = 2;
+    hdr.timestamp = TIMESTAMP + COUNT;
+    hdr.size = data.size() + 5000;
+
+    if(Verify(mDBStream->Write(&hdr, ss)))
+    {
+        mChecksums[hdr.id] = Checksum(Checksum(0, NULL, 0), data.data(), data.size());
+
+        StreamHeader last;
+        last.id = 0;
+        mDBStream->GetLast(&last);
+
+        cout << __func__ << (Verify(last.id == hdr.id && last.size == data.size()) ? "" : " [ERROR]")
+             << ": header size=" << hdr.size << ", stored size=" << last.size << endl;
+    }
+
+    // The small streams, where the round trips of the stream record count the most
+    {
+        CStopWatch t(string(__func__) + ": 200 small streams: ");
+
+        std::vector<unsigned char> small = MakeData(100, COUNT + 1);
+        for(size_t i = 0; i < 200; i++)
+            WriteData(mDBStream, "header_small", small, TIMESTAMP + COUNT + 1);
+    }
+
+    Verify(mDBStream->ReadByTimestamp(TIMESTAMP, true, TIMESTAMP + COUNT, true));
+    mDBStream->DeleteByTimestamp(TIMESTAMP, true, TIMESTAMP + COUNT + 1, true);
+}
+
+void DBStreamClient::TestStatements()
+{
+    cout << endl << "Testing prepared statements..." << endl;
+
+    // Up to 8 chunks per INSERT, so the streams of up to 8 chunks get
+    // a statement of their own shape and the longer ones reuse the full one
+    DBStreamOptions options;
+    options.chunk_size = 1000;
+    options.write_batch_size = 8000;
+
+    DBStream* stream = CreateStream(options);
+    if(!Verify(stream != NULL))
+    {
+        cout << __func__ << " [ERROR]" << endl;
+        return;
+    }
+
+    const size_t COUNT = 200;
+    std::vector<uint64_t> ids;
+    {
+        CStopWatch t(string(__func__) + ": Write: ");
+
+        for(size_t i = 0; i < COUNT; i++)
+        {
+            string descr = "statements_" + to_string(i);
+            uint64_t id = WriteData(stream, descr.c_str(), MakeData((i % 20) * 1000 + i, i));
+            if(id > 0)
+                ids.push_back(id);
+        }
+    }
+
+    {
+        CStopWatch t(string(__func__) + ": Lookup: ");
+
+        bool found = false;
+        size_t count = 0;
+        for(uint64_t id : ids)
+        {
+            if(stream->LookupById(id, &found) && found)
+                count++;
+        }
+
+        cout << __func__ << (Verify(count == ids.size()) ? "" : " [ERROR]")
+             << ": found=" << count << " of " << ids.size() << endl;
+    }
+
+    if(!ids.empty())
+    {
+        Verify(stream->ReadById(ids.front(), true, ids.back(), true));
+        stream->DeleteById(ids.front(), true, ids.back(), true);
+    }
+
+    stream->Destroy();
+}
+
+void DBStreamClient::TestWriteBuffer()
+{
+    cout << endl << "Testing write from buffer and stream..." << endl;
+
+    std::vector<unsigned char> data = MakeData(32*1024*1024 + 3, 18);
+    uint64_t id_buffer = 0;
+    uint64_t id_stream = 0;
+
+    // The chunks are bound right from the buffer
+    {
+        CStopWatch t(string(__func__) + ": Write(buffer): ");
+        id_buffer = WriteData(mDBStream, "write_buffer", data);
+    }
+
+    // The chunks are copied from the stream
+    {
+        CStopWatch t(string(__func__) + ": Write(istream): ");
+
+        std::stringstream ss(std::string(data.begin(), data.end()));
+
+        StreamHeader hdr;
+        hdr.descr = "write_istream";
+        hdr.type = 2;
+        hdr.timestamp = 0;
+        hdr.size = data.size();
+
+        if(Verify(mDBStream->Write(&hdr, ss)))
+            id_stream = hdr.id;
+        else
+            cout << __func__ << ": Write(istream) [ERROR]" << endl;
+    }
+
+    if(id_stream > 0)
+        mChecksums[id_stream] = Checksum(Checksum(0, NULL, 0), data.data(), data.size());
+
+    if(id_buffer > 0)
+    {
+        ReadBack(mDBStream, id_buffer);
+        mDBStream->DeleteById(id_buffer, true, id_buffer, true);
+    }
+
+    if(id_stream > 0)
+    {
+        ReadBack(mDBStream, id_stream);
+        mDBStream->DeleteById(id_stream, true, id_stream, true);
+    }
+}
+
+void DBStreamClient::TestReadDirect()
+{
+    cout << endl << "Testing direct read..." << endl;
+
+    // Every chunk comes in one piece
+    const size_t CHUNK_SIZE = 65535;
+    const size_t sizes[] = { 0, 1, CHUNK_SIZE, CHUNK_SIZE + 1, 200000, 32*1024*1024 };
+    std::vector<uint64_t> ids;
+    size_t chunks = 0;
+
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        string descr = "read_direct_" + to_string(sizes[i]);
+        uint64_t id = WriteData(mDBStream, descr.c_str(), MakeData(sizes[i], i));
+        if(id > 0)
+            ids.push_back(id);
+        chunks += (sizes[i] + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    }
+
+    const int modes[] = { DB_STREAM_READ_MODE_CHUNK, DB_STREAM_READ_MODE_STREAM, DB_STREAM_READ_MODE_BATCH };
+    const char* names[] = { "chunk", "stream", "batch" };
+
+    for(size_t i = 0; i < sizeof(modes) / sizeof(modes[0]) && !ids.empty(); i++)
+    {
+        for(int direct = 0; direct <= 1; direct++)
+        {
+            DBStreamOptions options;
+            options.read_mode = modes[i];
+            options.read_direct = direct;
+
+            StreamCounter counter(true);
+            DBStream* stream = CreateStream(options, &counter);
+            if(!Verify(stream != NULL))
+                continue;
+
+            bool ok = false;
+            {
+                CStopWatch t(string(__func__) + ": " + names[i] + (direct ? " direct: " : ": "));
+                ok = stream->ReadById(ids.front(), true, ids.back(), true);
+            }
+
+            ok = ok && counter.mCount == ids.size() && !counter.mError;
+            if(direct)
+                ok = ok && counter.mPieces == chunks;
+
+            cout << __func__ << (Verify(ok) ? "" : " [ERROR]")
+                 << ": " << names[i] << (direct ? " direct" : "")
+                 << ": pieces=" << counter.mPieces << endl;
+
+            stream->Destroy();
+
+            // And the data is the same
+            if(direct)
+            {
+                stream = CreateStream(options);
+                if(Verify(stream != NULL))
+                {
+                    Verify(stream->ReadById(ids.front(), true, ids.back(), true));
+                    stream->Destroy();
+                }
+            }
+        }
+    }
+
+    if(!ids.empty())
+        mDBStream->DeleteById(ids.front(), true, ids.back(), true);
+}
+
+void DBStreamClient::TestCompression()
+{
+    cout << endl << "Testing compression..." << endl;
+
+    DBStreamOptions options;
+    options.codec = DB_STREAM_CODEC_ZLIB;
+
+    DBStream* stream = CreateStream(options);
+    if(!Verify(stream != NULL))
+    {
+        cout << __func__ << " [ERROR]" << endl;
+        return;
+    }
+
+    // The random data doesn't compress, so its chunks are stored as is
+    std::vector<uint64_t> ids;
+    WriteTestData(stream, "codec_zlib", &ids);
+
+    // Compressible data, partly random
+    std::vector<unsigned char> data(1024*1024 + 11, 'a');
+    std::vector<unsigned char> noise = MakeData(data.size() / 4, 20);
+    std::copy(noise.begin(), noise.end(), data.begin() + data.size() / 2);
+
+    {
+        CStopWatch t(string(__func__) + ": Write: ");
+        ids.push_back(WriteData(stream, "codec_zlib_compressible", data));
+    }
+
+    // The stream without the codec reads the same, as do the read modes
+    if(ids.back() > 0)
+    {
+        Verify(stream->ReadById(ids.front(), true, ids.back(), true));
+        Verify(mDBStream->ReadById(ids.front(), true, ids.back(), true));
+
+        for(uint64_t id : ids)
+            ReadBack(mDBStream, id);
+
+        options.codec = DB_STREAM_CODEC_NONE;
+        options.read_mode = DB_STREAM_READ_MODE_BATCH;
+        options.read_direct = true;
+
+        DBStream* batch = CreateStream(options);
+        if(Verify(batch != NULL))
+        {
+            Verify(batch->ReadById(ids.front(), true, ids.back(), true));
+            batch->Destroy();
+        }
+
+        mDBStream->DeleteById(ids.front(), true, ids.back(), true);
+    }
+
+    stream->Destroy();
+}
+
+// The database is expected to have the data table of the old layout (written
+// by the earlier version), migrated on the first run and left as is after
+void DBStreamClient::TestMigrateLayout(const char* database)
+{
+    cout << endl << "Testing layout migration with '" << database << "'..." << endl;
+
+    StreamCounter before(true);
+    StreamCounter after(true);
+
+    DBStream* stream = CreateStream(DBStreamOptions(), &before, database);
+    if(stream == NULL)
+    {
+        cout << "The database \"" << database << "\" doesn't exist or isn't accessible" << endl;
+        return;
+    }
+
+    Verify(stream->ReadById(0, true, 0, true));
+    stream->Destroy();
+
+    {
+        CStopWatch t(string(__func__) + ": MigrateLayout: ");
+
+        stream = CreateStream(DBStreamOptions(), &after, database);
+        if(!Verify(stream != NULL && stream->MigrateLayout()))
+            cout << __func__ << ": MigrateLayout [ERROR]" << endl;
+    }
+
+    if(stream == NULL)
+        return;
+
+    // Migrated already
+    Verify(stream->MigrateLayout());
+
+    // The same streams
+    Verify(stream->ReadById(0, true, 0, true));
+
+    cout << __func__ << (Verify(before.mCount == after.mCount && before.mSize == after.mSize &&
+                                !before.mError && !after.mError) ? "" : " [ERROR]")
+         << ": streams=" << after.mCount
+         << ", size=" << after.mSize << endl;
+
+    // And the ones written in the new layout
+    std::vector<uint64_t> ids;
+    if(WriteTestData(stream, "migrated", &ids))
+    {
+        for(uint64_t id : ids)
+            ReadBack(stream, id);
+    }
+
+    if(!ids.empty())
+        stream->DeleteById(ids.front(), true, ids.back(), true);
+
+    stream->Destroy();
+
+    // The ids of the other database are no good for the checksums
+    for(uint64_t id : ids)
+        mChecksums.erase(id);
+}
+
+void DBStreamClient::TestReadRange()
+{
+    cout << endl << "Testing read range..." << endl;
+
+    // Keep the data of the read range
+    struct RangeReader : public DBStreamReader
+    {
+        virtual bool OnRead(const StreamHeader* hdr,
+                            unsigned char* data, size_t size,
+                            int reading_state)
+        {
+            if(reading_state == DB_STREAM_READ_BEGIN)
+                mData.clear();
+            else if(reading_state == DB_STREAM_READ_DATA)
+                mData.insert(mData.end(), data, data + size);
+            return true;
+        }
+
+        std::vector<unsigned char> mData;
+    };
+
+    // The chunks stored as is and the compressed ones
+    DBStreamOptions options[2];
+    options[0].chunk_size = 1000;
+    options[1].codec = DB_STREAM_CODEC_ZLIB;
+
+    for(const DBStreamOptions& opts : options)
+    {
+        RangeReader reader;
+        DBStream* stream = CreateStream(opts, &reader);
+        if(!Verify(stream != NULL))
+        {
+            cout << __func__ << " [ERROR]" << endl;
+            continue;
+        }
+
+        const uint64_t SIZE = 200000;
+        std::vector<unsigned char> data = MakeData(SIZE, 22);
+        std::fill(data.begin(), data.begin() + SIZE / 2, 'a');
+        uint64_t id = WriteData(stream, "read_range", data);
+
+        // Whole, inside a chunk, across the chunks, to the end, past the end
+        const uint64_t ranges[][2] = { { 0, 0 }, { 10, 20 }, { 990, 20 }, { 65530, 10 },
+                                       { 1000, 100000 }, { SIZE - 1, 0 }, { SIZE + 10, 5 } };
+
+        for(size_t i = 0; id > 0 && i < sizeof(ranges) / sizeof(ranges[0]); i++)
+        {
+            uint64_t offset = ranges[i][0];
+            uint64_t size = ranges[i][1];
+            bool found = false;
+
+            bool ok = stream->ReadRange(id, offset, size, &found) && found;
+
+            uint64_t begin = std::min(offset, SIZE);
+            uint64_t end = (size > 0 ? std::min(begin + size, SIZE) : SIZE);
+            ok = ok && reader.mData.size() == end - begin &&
+                 std::equal(data.begin() + begin, data.begin() + end, reader.mData.begin());
+
+            cout << __func__ << (Verify(ok) ? "" : " [ERROR]")
+                 << ": id="        << id
+                 << ", offset="    << offset
+                 << ", size="      << size
+                 << ", read_size=" << reader.mData.size() << endl;
+        }
+
+        // No such stream
+        bool found = true;
+        Verify(stream->ReadRange(id + 1000000, 0, 0, &found) && !found);
+
+        if(id > 0)
+            stream->DeleteById(id, true, id, true);
+
+        stream->Destroy();
+    }
+}
+
+void DBStreamClient::TestOpenStreams()
+{
+    cout << endl << "Testing open streams..." << endl;
+
+    StreamCounter counter(false); // Reads the same streams again and again
+    StreamCounter tailer(true);
+    DBStream* reader = CreateStream(DBStreamOptions(), &counter);
+    DBStream* tail = CreateStream(DBStreamOptions(), &tailer);
+    if(!Verify(reader != NULL && tail != NULL))
+    {
+        cout << __func__ << " [ERROR]" << endl;
+        if(reader != NULL)
+            reader->Destroy();
+        if(tail != NULL)
+            tail->Destroy();
+        return;
+    }
+
+    // The open stream between two written ones
+    uint64_t id_first = WriteData(mDBStream, "open_before", MakeData(1000, 0));
+
+    StreamHeader hdr;
+    hdr.id = 0;
+    hdr.descr = "open_appended";
+    hdr.type = 2;
+    hdr.timestamp = 0;
+    hdr.size = 0;
+    Verify(mDBStream->Open(&hdr));
+
+    uint64_t id_last = WriteData(mDBStream, "open_after", MakeData(1000, 1));
+
+    // Tail the open stream on its own thread while appending
+    bool found = false;
+    bool tailed = false;
+    std::thread thread([tail, &hdr, &found, &tailed] {
+        tailed = tail->Tail(hdr.id, 0, &found);
+    });
+
+    const size_t APPEND_SIZE = 70001;
+    std::vector<unsigned char> data = MakeData(300000, 23);
+    size_t appends = 0;
+    for(size_t pos = 0; pos < data.size(); pos += APPEND_SIZE)
+    {
+        Verify(mDBStream->Append(&hdr, data.data() + pos, std::min(APPEND_SIZE, data.size() - pos)));
+        appends++;
+
+        // Read as far as appended
+        bool range_found = false;
+        Verify(reader->ReadRange(hdr.id, 0, 0, &range_found) && range_found &&
+               counter.mSize == std::min(pos + APPEND_SIZE, data.size()));
+        counter.Reset();
+
+        // Skipped while open
+        Verify(reader->ReadById(id_first, true, id_last, true) && counter.mCount == 2);
+        counter.Reset();
+    }
+
+    cout << __func__ << ": appends=" << appends << endl;
+
+    Verify(mDBStream->Seal(&hdr));
+
+    // Tail() ends with the seal
+    thread.join();
+
+    cout << __func__ << (Verify(tailed && found && tailer.mCount == 1 && tailer.mSize == data.size() &&
+                                !tailer.mError) ? "" : " [ERROR]")
+         << ": tailed=" << tailer.mSize << endl;
+
+    // Sealed once, and only the open stream
+    StreamHeader missing = hdr;
+    missing.id = id_last + 1000000;
+    bool resealed = mDBStream->Seal(&hdr);
+    bool appended = mDBStream->Append(&hdr, data.data(), 1);
+
+    cout << __func__ << (Verify(!resealed && !appended && !mDBStream->Seal(&missing)) ? "" : " [ERROR]")
+         << ": sealed again=" << resealed
+         << ", appended after seal=" << appended << endl;
+
+    // Read as any other stream once sealed
+    mChecksums[hdr.id] = Checksum(Checksum(0, NULL, 0), data.data(), data.size());
+    ReadBack(mDBStream, hdr.id);
+    Verify(mDBStream->ReadById(id_first, true, id_last, true));
+
+    mDBStream->DeleteById(id_first, true, id_last, true);
+
+    reader->Destroy();
+    tail->Destroy();
+}
+
+void DBStreamClient::TestDedup()
+{
+    cout << endl << "Testing dedup refcounting..." << endl;
+
+    DBStreamOptions options;
+    options.dedup = true;
+
+    DBStream* stream = CreateStream(options);
+    if(!Verify(stream != NULL))
+    {
+        cout << __func__ << " [ERROR]" << endl;
+        return;
+    }
+
+    // The same data, the data shifted by a few bytes (the chunks past the
+    // first cut are the same), the data compressed and the data written
+    // without dedup
+    std::vector<unsigned char> data = MakeData(1024*1024, 24);
+    std::vector<unsigned char> shifted = MakeData(7, 25);
+    shifted.insert(shifted.end(), data.begin(), data.end());
+
+    options.codec = DB_STREAM_CODEC_ZLIB;
+    DBStream* compressed = CreateStream(options);
+
+    std::vector<uint64_t> ids;
+    ids.push_back(WriteData(stream, "dedup_original", data));
+    ids.push_back(WriteData(stream, "dedup_duplicate", data));
+    ids.push_back(WriteData(stream, "dedup_shifted", shifted));
+    ids.push_back(compressed != NULL ? WriteData(compressed, "dedup_compressed", data) : 0);
+    ids.push_back(WriteData(mDBStream, "dedup_none", data));
+
+    if(compressed != NULL)
+        compressed->Destroy();
+
+    if(!Verify(std::find(ids.begin(), ids.end(), 0) == ids.end()))
+    {
+        cout << __func__ << ": Write [ERROR]" << endl;
+        stream->Destroy();
+        return;
+    }
+
+    // The shared chunks stay as long as any stream refers to them
+    for(size_t i = 0; i < ids.size(); i++)
+    {
+        for(size_t j = i; j < ids.size(); j++)
+            ReadBack(stream, ids[j]);
+
+        stream->DeleteById(ids[i], true, ids[i], true);
+    }
+
+    // The chunks are stored again once all their streams are deleted
+    uint64_t id = WriteData(stream, "dedup_again", data);
+    if(id > 0)
+    {
+        ReadBack(stream, id);
+        Verify(stream->ReadById(id, true, id, true));
+        stream->DeleteById(id, true, id, true);
+    }
+
+    stream->Destroy();
+}
+
+void DBStreamClient::TestChecksums()
+{
+    cout << endl << "Testing checksums..." << endl;
+
+    // Alone, with the codec, and with dedup too
+    DBStreamOptions options[3];
+    options[0].checksum = true;
+    options[1].checksum = true;
+    options[1].codec = DB_STREAM_CODEC_ZLIB;
+    options[2] = options[1];
+    options[2].dedup = true;
+
+    for(const DBStreamOptions& opts : options)
+    {
+        DBStream* stream = CreateStream(opts);
+        if(!Verify(stream != NULL))
+        {
+            cout << __func__ << " [ERROR]" << endl;
+            continue;
+        }
+
+        // The chunks are verified by any stream reading them
+        std::vector<uint64_t> ids;
+        if(WriteTestData(stream, "checksum", &ids))
+        {
+            Verify(stream->ReadById(ids.front(), true, ids.back(), true));
+            Verify(mDBStream->ReadById(ids.front(), true, ids.back(), true));
+
+            for(uint64_t id : ids)
+                ReadBack(mDBStream, id);
+
+            // And by the ranged reads
+            StreamCounter counter(true);
+            DBStream* range = CreateStream(DBStreamOptions(), &counter);
+            if(Verify(range != NULL))
+            {
+                bool found = false;
+                Verify(range->ReadRange(ids.back(), 70000, 100000, &found) && found &&
+                       counter.mSize == 100000);
+                range->Destroy();
+            }
+        }
+
+        if(!ids.empty())
+            mDBStream->DeleteById(ids.front(), true, ids.back(), true);
+
+        stream->Destroy();
+    }
+}
+
+bool DBStreamClient::OnRead(const StreamHeader* hdr,
+                            unsigned char* data, size_t size, 
+                            int reading_state)
+{
+    static CStopWatch st(string(__func__) + ": ", true);
+    static size_t read_size = 0;
+    static uint64_t read_hash = Checksum(0, NULL, 0);
+
+    switch(reading_state)
+    {
+    case DB_STREAM_READ_BEGIN:
+        st.Start();
+        read_size = 0;
+        read_hash = Checksum(0, NULL, 0);
+        cout << __func__
+             << ": id="     << hdr->id
+             << ", descr='" << hdr->descr << "'"
+             << ", type="   << (int)hdr->type
+             << ", size="   << hdr->size << " ..." << endl;
+        break;
+
+    case DB_STREAM_READ_DATA:
+        read_size += size;
+        read_hash = Checksum(read_hash, data, size);
+        break;
+
+    case DB_STREAM_READ_END:
+    {
+        // Only the streams written by the tests have the checksum
+        std::unique_lock<std::mutex> lock(mChecksumsMutex);
+        std::map<uint64_t, uint64_t>::const_iterator it = mChecksums.find(hdr->id);
+        bool corrupt = (it != mChecksums.end() && it->second != read_hash);
+        lock.unlock();
+
+        cout << __func__ << (Verify(read_size == hdr->size && !corrupt) ? "" : "[ERROR]")
+             << ": id="        << hdr->id
+             << ", descr='"    << hdr->descr << "'"
+             << ", type="      << (int)hdr->type
+             << ", size="      << hdr->size
+             << ", read_size=" << read_size << endl;
+        read_size = 0;
+        st.Stop();
+        break;
+    }
+    }
+     
+    return true;
+}
+
+int main(int argc, const char** argv)
+{
+    cout << boolalpha;
+
+    // Get the canonicalized absolute pathname
+    char libname[PATH_MAX]{};
+    realpath(argv[0], libname);
+    const char* dir = dirname(libname);
+    libname[strlen(dir)] = '\0';
+    strcat(libname, "/libmysqlstream.so");
+
+    const char* DB_HOST = "tcp://localhost:3309";
+    const char* DB_NAME = "StreamDB";
+    const char* DB_USER = "Loader";
+    const char* DB_PASS = "Loader";
+
+    DBStreamClient dbstreamClient(libname, DB_HOST, DB_USER, DB_PASS, DB_NAME);
+    if(!dbstreamClient.IsValid())
+        return 1;
+    
+    dbstreamClient.Describe();
+    dbstreamClient.Lookup();
+
+    // Write all files from the current user Download directory 
+    struct passwd* pwd = getpwuid(getuid());
+    string writeDir(pwd ? pwd->pw_dir : ".");
+    writeDir += "/Downloads";
+    if(access(writeDir.c_str(), F_OK | R_OK) == 0)
+    {
+        dbstreamClient.WriteDir(writeDir.c_str());
+    }
+    else
+    {
+        cout << "The directory \"" << writeDir << "\" doesn't exist or isn't readable" << endl;
+    }
+
+    // Write largeDataFile - expected to be the current directory
+    string largeFile("./largeDataFile");
+    if(access(largeFile.c_str(), F_OK | R_OK) == 0)
+    {
+        dbstreamClient.WriteFileLarge(largeFile.c_str());
+    }
+    else
+    {
+        cout << "The file \"" << largeFile << "\" doesn't exist or isn't readable" << endl;
+    }
+
+    dbstreamClient.Read();
+    dbstreamClient.ReadCursor();
+    dbstreamClient.Lookup();
+
+    dbstreamClient.Delete();
+    dbstreamClient.Lookup();
+
+    dbstreamClient.TestReadModes();
+    dbstreamClient.TestUnbuffered();
+    dbstreamClient.TestWriteBatches();
+    dbstreamClient.TestChunkSizes();
+    dbstreamClient.TestPool();
+    dbstreamClient.TestSnapshot();
+    dbstreamClient.TestWriter();
+    dbstreamClient.TestWriteBatch();
+    dbstreamClient.TestFollow();
+    dbstreamClient.TestCursor();
+    dbstreamClient.TestParallelRead();
+    dbstreamClient.TestTimestamps();
+    dbstreamClient.TestRetention("StreamDBPartitioned");
+    dbstreamClient.TestDeleteAll();
+    dbstreamClient.TestPurge();
+    dbstreamClient.TestWriteHeader();
+    dbstreamClient.TestStatements();
+    dbstreamClient.TestWriteBuffer();
+    dbstreamClient.TestReadDirect();
+    dbstreamClient.TestCompression();
+    dbstreamClient.TestMigrateLayout("StreamDBLegacy");
+    dbstreamClient.TestReadRange();
+    dbstreamClient.TestOpenStreams();
+    dbstreamClient.TestDedup();
+    dbstreamClient.TestChecksums();
+
+    if(dbstreamClient.mFailures > 0)
+    {
+        cout << "Failed: " << dbstreamClient.mFailures << " error(s)" << endl;
+        return 1;
+    }
 
     cout << "Done!" << endl;
     return 0;